@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+#include "BuildGraph.h"
+#include "ThreadPool.h"
+#include "IncludeScanner.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <ostream>
+
+namespace {
+// long lists are cut, report is for reading.
+const size_t g_topCount     = 10;
+const size_t g_namesInGroup = 5;
+
+const char* typeName(VcProjectInfo::Type type)
+{
+    switch (type) {
+        case VcProjectInfo::Type::Static:
+            return "static";
+        case VcProjectInfo::Type::Dynamic:
+            return "dynamic";
+        case VcProjectInfo::Type::App:
+            return "app";
+        case VcProjectInfo::Type::Utility:
+            return "utility";
+        default:
+            return "unknown";
+    }
+}
+
+double percentOf(size_t part, size_t total)
+{
+    return total ? 100.0 * part / total : 0;
+}
+}
+
+BuildGraph::BuildGraph(const VcProjectList& projects, ThreadPool* pool, IncludeScanner* scanner)
+    : weighted(pool && scanner)
+{
+    std::map<const VcProjectInfo*, size_t> indexes;
+    for (const auto& p : projects) {
+        indexes[&p] = nodes.size();
+        Node node;
+        node.project = &p;
+        node.sources = p.clCompileFiles.size() + p.rcCompileFiles.size();
+        // configs differ in flags, not in steps, so first one is enough.
+        if (!p.parsedConfigs.empty())
+            node.customCommands = p.parsedConfigs[0].customCommands.size();
+        nodes.push_back(node);
+    }
+    // includes of first config too: other ones rarely add headers, and scan results are cached per include list.
+    if (weighted) {
+        std::vector<std::future<void>> scans;
+        for (Node& node : nodes) {
+            if (node.project->parsedConfigs.empty())
+                continue;
+            scans.push_back(pool->Enqueue([&node, scanner] {
+                for (const auto& source : node.project->clCompileFiles)
+                    node.includes += scanner->ScanTransitive(source, node.project->parsedConfigs[0].includes).size();
+            }));
+        }
+        for (auto& scan : scans)
+            scan.get();
+    }
+    for (Node& node : nodes)
+        node.cost = node.sources + node.includes + node.customCommands + (node.project->type == VcProjectInfo::Type::Utility ? 0 : 1);
+
+    // dependencies were checked for cycles on load, so recursion ends; each node is visited once.
+    std::vector<bool>            done(nodes.size());
+    std::function<void(size_t)> visit = [&](size_t i) {
+        if (done[i])
+            return;
+        Node& node = nodes[i];
+        for (const VcProjectInfo* dep : node.project->dependentTargets) {
+            const size_t d = indexes.at(dep);
+            visit(d);
+            nodes[d].dependents++;
+            edges++;
+            node.level = std::max(node.level, nodes[d].level + 1);
+            if (node.pathPrev == npos || nodes[d].pathCost > nodes[node.pathPrev].pathCost)
+                node.pathPrev = d;
+        }
+        node.pathCost = node.cost + (node.pathPrev == npos ? 0 : nodes[node.pathPrev].pathCost);
+        levels        = std::max(levels, node.level + 1);
+        done[i]       = true;
+    };
+    for (size_t i = 0; i < nodes.size(); ++i)
+        visit(i);
+}
+
+std::vector<size_t> BuildGraph::CriticalPath() const
+{
+    std::vector<size_t> path;
+    if (nodes.empty())
+        return path;
+    size_t last = 0;
+    for (size_t i = 1; i < nodes.size(); ++i)
+        if (nodes[i].pathCost > nodes[last].pathCost)
+            last = i;
+    for (size_t i = last; i != npos; i = nodes[i].pathPrev)
+        path.push_back(i);
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+void BuildGraph::WriteStats(std::ostream& os) const
+{
+    size_t                        totalCost = 0, totalSources = 0, totalCustom = 0;
+    std::map<std::string, size_t> types;
+    std::vector<size_t>           levelWidths(levels);
+    for (const auto& node : nodes) {
+        totalCost += node.cost;
+        totalSources += node.sources;
+        totalCustom += node.customCommands;
+        types[typeName(node.project->type)]++;
+        levelWidths[node.level]++;
+    }
+    const auto widest = std::max_element(levelWidths.cbegin(), levelWidths.cend());
+
+    os << "Projects: " << nodes.size() << " (";
+    for (auto it = types.cbegin(); it != types.cend(); ++it)
+        os << (it == types.cbegin() ? "" : ", ") << it->first << " " << it->second;
+    os << "), dependency edges: " << edges << "\n";
+    os << "Levels: " << levels;
+    if (widest != levelWidths.cend())
+        os << ", widest is level " << (widest - levelWidths.cbegin()) << " with " << *widest << " projects";
+    os << "\n";
+    os << "Sources: " << totalSources << ", custom commands: " << totalCustom << ", estimated cost: " << totalCost << " " << CostUnit() << "\n";
+    if (weighted)
+        os << "Cost: compiled source weighs 1 plus its transitive includes, custom commands and links weigh 1 each\n";
+    else
+        os << "Cost is step count only: sources are not weighted, use --scan-includes to weigh them by includes\n";
+
+    const std::vector<size_t> path = CriticalPath();
+    const size_t              pathCost = path.empty() ? 0 : nodes[path.back()].pathCost;
+    os << std::fixed << std::setprecision(1);
+    os << "\nCritical path: " << path.size() << " projects, " << pathCost << " " << CostUnit() << " (" << percentOf(pathCost, totalCost) << "% of total)";
+    if (pathCost)
+        os << ", parallelism bound by project order: " << double(totalCost) / pathCost;
+    os << "\n";
+    for (size_t i : path)
+        os << "  " << nodes[i].project->targetName << ": " << nodes[i].cost << " " << CostUnit() << "\n";
+
+    auto writeTop = [&os, this](const std::string& title, auto value, const char* unit) {
+        std::vector<const Node*> sorted;
+        for (const auto& node : nodes)
+            if (value(node))
+                sorted.push_back(&node);
+        // stable, so ties keep solution order and report does not change between runs.
+        std::stable_sort(sorted.begin(), sorted.end(), [&value](const Node* l, const Node* r) { return value(*l) > value(*r); });
+        if (sorted.empty())
+            return;
+        os << "\n" << title << ":\n";
+        for (size_t i = 0; i < std::min(sorted.size(), g_topCount); ++i)
+            os << "  " << sorted[i]->project->targetName << ": " << value(*sorted[i]) << " " << unit << "\n";
+    };
+    writeTop("Most depended on", [](const Node& node) { return node.dependents; }, "dependents");
+    writeTop("Most dependencies", [](const Node& node) { return node.project->dependentTargets.size(); }, "dependencies");
+    writeTop("Costliest", [](const Node& node) { return node.cost; }, CostUnit());
+    writeTop("Most custom commands", [](const Node& node) { return node.customCommands; }, "commands");
+
+    // same include list in many projects is a candidate for shared property sheet or response file.
+    std::map<StringVector, std::set<std::string>> includeLists;
+    size_t                                        configCount = 0;
+    for (const auto& node : nodes) {
+        for (const auto& config : node.project->parsedConfigs) {
+            if (config.includes.empty())
+                continue;
+            includeLists[config.includes].insert(node.project->targetName);
+            configCount++;
+        }
+    }
+    std::vector<const std::pair<const StringVector, std::set<std::string>>*> shared;
+    for (const auto& list : includeLists)
+        if (list.second.size() > 1)
+            shared.push_back(&list);
+    std::stable_sort(shared.begin(), shared.end(), [](auto l, auto r) { return l->second.size() > r->second.size(); });
+    os << "\nInclude lists: " << includeLists.size() << " distinct in " << configCount << " configs, " << shared.size() << " shared by several projects\n";
+    for (size_t i = 0; i < std::min(shared.size(), g_topCount); ++i) {
+        const auto& owners = shared[i]->second;
+        os << "  " << shared[i]->first.size() << " dirs in " << owners.size() << " projects:";
+        size_t written = 0;
+        for (auto it = owners.cbegin(); it != owners.cend() && written < g_namesInGroup; ++it, ++written)
+            os << " " << *it;
+        if (owners.size() > written)
+            os << " and " << owners.size() - written << " more";
+        os << "\n";
+    }
+}
+
+void BuildGraph::WriteDot(std::ostream& os) const
+{
+    const std::vector<size_t> path = CriticalPath();
+    const std::set<size_t>    onPath(path.cbegin(), path.cend());
+    size_t                    maxCost = 1;
+    for (const auto& node : nodes)
+        maxCost = std::max(maxCost, node.cost);
+
+    os << "digraph build {\n";
+    os << "    node [shape=box, style=filled, fillcolor=white];\n";
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const Node& node = nodes[i];
+        // area grows with cost, so costly projects stand out without hiding cheap ones.
+        const double scale = std::sqrt(double(node.cost) / maxCost);
+        os << "    \"" << node.project->targetName << "\" [label=\"" << node.project->targetName << "\\n"
+           << node.sources << " sources, " << node.cost << " " << CostUnit() << "\""
+           << ", sources=" << node.sources << ", cost=" << node.cost << ", level=" << node.level
+           << ", width=" << 1.5 + 3 * scale << ", height=" << 0.5 + scale
+           << (node.project->type == VcProjectInfo::Type::Utility ? ", fillcolor=lightgray" : "")
+           << (onPath.count(i) ? ", color=red, penwidth=3" : "") << "];\n";
+    }
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        for (const VcProjectInfo* dep : nodes[i].project->dependentTargets) {
+            const bool critical = onPath.count(i) && nodes[i].pathPrev != npos && nodes[nodes[i].pathPrev].project == dep;
+            os << "    \"" << nodes[i].project->targetName << "\" -> \"" << dep->targetName << "\""
+               << (critical ? " [color=red, penwidth=3, weight=10]" : "") << ";\n";
+        }
+    }
+    os << "}\n";
+}
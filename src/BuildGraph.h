@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+
+#pragma once
+
+#include "VcProjectInfo.h"
+
+#include <iosfwd>
+
+class ThreadPool;
+class IncludeScanner;
+
+/// Project dependency graph of converted solution, weighted by estimated build cost, to find what limits parallelism.
+/// Built from model, so projects should not be released, see VcProjectInfo::ReleaseData.
+class BuildGraph {
+    static constexpr size_t npos = size_t(-1);
+
+    struct Node {
+        const VcProjectInfo* project        = nullptr;
+        size_t               sources        = 0;
+        size_t               customCommands = 0;
+        size_t               includes       = 0; // transitive includes of compiled sources, when scanned.
+        size_t               cost           = 0; // compiled sources with their includes, custom commands and link.
+        size_t               dependents     = 0;
+        size_t               level          = 0; // length of longest dependency chain below node.
+        size_t               pathCost       = 0; // of costliest dependency chain ending with node, including it.
+        size_t               pathPrev       = npos;
+    };
+    std::vector<Node> nodes; // in solution order.
+    size_t            edges    = 0;
+    size_t            levels   = 0;
+    bool              weighted = false; // sources weighted by their includes, otherwise cost is step count only.
+
+public:
+    /// With scanner, every compiled source weighs one plus its transitive includes, as files compiler reads;
+    /// sources are scanned in pool. Without it, every step weighs one.
+    BuildGraph(const VcProjectList& projects, ThreadPool* pool = nullptr, IncludeScanner* scanner = nullptr);
+
+    /// Human readable report: totals, fan-in, duplicate include lists and critical path.
+    void WriteStats(std::ostream& os) const;
+    /// Graphviz digraph, project -> dependency; node size follows cost, critical path is highlighted.
+    void WriteDot(std::ostream& os) const;
+
+private:
+    const char* CostUnit() const { return weighted ? "files" : "steps"; }
+    /// Costliest dependency chain, from first built project to last.
+    std::vector<size_t> CriticalPath() const;
+};
@@ -1,6 +1,8 @@
 #include "CommandLine.h"
 #include "VariableMap.h"
+#include "StringKernels.h"
 
+#include <algorithm>
 #include <filesystem>
 namespace fs = std::filesystem;
 using fserr  = std::error_code;
@@ -11,14 +13,34 @@ namespace {
 const std::string g_buildOption           = "--build";
 const std::string g_ninjaOption           = "--ninja";
 const std::string g_cmakeOption           = "--cmake";
+const std::string g_batchOption           = "--batch";             // file with build directory per line, instead of --build
 const std::string g_dryOption             = "--dry";
 const std::string g_verboseOption         = "--verbose";
-const std::string g_depsOption            = "--deps";             // e.g. --deps InstallProduct=Release_InstallBuildFixupRelease
-const std::string g_preferredConfigOption = "--preferred-config"; // e.g. --preferred-config Debug
+const std::string g_depsOption            = "--deps";              // e.g. --deps InstallProduct=Release_InstallBuildFixupRelease
+const std::string g_preferredConfigOption = "--preferred-config";  // e.g. --preferred-config Debug
+const std::string g_platformsOption       = "--platforms";         // e.g. --platforms x64,ARM64
+const std::string g_jobsOption            = "--jobs";              // e.g. --jobs 4
+const std::string g_scanIncludesOption    = "--scan-includes";     // pre-seed .ninja_deps for already built objects
+const std::string g_launcherOption        = "--compiler-launcher"; // e.g. --compiler-launcher sccache
+const std::string g_z7Option              = "--z7";                // embed debug info in objects instead of shared pdb
+const std::string g_localJobsOption       = "--local-jobs";        // e.g. --local-jobs 8
+const std::string g_remoteJobsOption      = "--remote-jobs";       // e.g. --remote-jobs 200
+const std::string g_preciseCodegenOption  = "--precise-codegen";   // scan includes to find objects using generated headers
+const std::string g_fastNoopOption        = "--fast-noop";         // fewer phony nodes, so no-op ninja run stats less
+const std::string g_linkProfileOption     = "--link-profile";      // fast: incremental /DEBUG:FASTLINK links for developers
+const std::string g_streamingOption       = "--streaming";         // bounded memory for huge solutions, at cost of some speed
+const std::string g_checkOption           = "--check";             // exit code 1 if conversion is needed, 0 if up-to-date
+const std::string g_graphStatsOption      = "--graph-stats";       // print project graph report: critical path, fan-in, shared include lists
+const std::string g_dotOption             = "--dot";               // write project graph into build.dot of build directory
+const std::string g_collateModulesOption  = "--collate-modules";   // run by ninja: e.g. --collate-modules lib.dir\Release\lib.collate
 }
 
 CommandLine::CommandLine(int argc, char* argv[])
 {
+    // ninja runs it from build directory, so path found relative to current one is made absolute.
+    const std::string self = argv[0];
+    moduleCollator         = "\"" + (FindFirstOf(self, "/\\") == std::string::npos ? self : fs::absolute(self).u8string()) + "\" " + g_collateModulesOption;
+
     std::string preferredConfig;
     for (int i = 1; i < argc; ++i) {
         const std::string arg = argv[i];
@@ -28,35 +50,81 @@ CommandLine::CommandLine(int argc, char* argv[])
             ninjaExe = argv[i + 1];
         else if (arg == g_cmakeOption && i < argc - 1)
             cmakeExe = argv[i + 1];
+        else if (arg == g_batchOption && i < argc - 1)
+            batchFile = argv[i + 1];
         else if (arg == g_preferredConfigOption && i < argc - 1)
             preferredConfig = argv[i + 1];
+        else if (arg == g_platformsOption && i < argc - 1)
+            platforms = strToList(argv[i + 1], ',');
+        else if (arg == g_jobsOption && i < argc - 1)
+            jobs = std::stoul(argv[i + 1]);
+        else if (arg == g_collateModulesOption && i < argc - 1)
+            collationFile = argv[i + 1];
+        else if (arg == g_launcherOption && i < argc - 1)
+            compilerLauncher = argv[i + 1];
+        else if (arg == g_linkProfileOption && i < argc - 1) {
+            const std::string profile = argv[i + 1];
+            if (profile != "fast" && profile != "default")
+                throw std::invalid_argument("unknown link profile: " + profile);
+            fastLink = profile == "fast";
+        } else if (arg == g_localJobsOption && i < argc - 1)
+            localJobs = std::stoul(argv[i + 1]);
+        else if (arg == g_remoteJobsOption && i < argc - 1)
+            remoteJobs = std::stoul(argv[i + 1]);
+        else if (arg == g_z7Option)
+            embedDebugInfo = true;
+        else if (arg == g_preciseCodegenOption)
+            preciseCodegen = true;
+        else if (arg == g_fastNoopOption)
+            fastNoop = true;
+        else if (arg == g_streamingOption)
+            streaming = true;
+        else if (arg == g_checkOption)
+            check = true;
+        else if (arg == g_graphStatsOption)
+            graphStats = true;
+        else if (arg == g_dotOption)
+            writeDot = true;
         else if (arg == g_dryOption)
             dryRun = true;
         else if (arg == g_verboseOption)
             verbose = true;
+        else if (arg == g_scanIncludesOption)
+            scanIncludes = true;
         else if (arg == g_depsOption && i < argc - 1) {
             auto depsPair = strToList(argv[i + 1], '=');
             if (depsPair.size() == 2)
                 additionalDeps[depsPair[0]] = strToList(depsPair[1], ',');
         }
     }
-    if (rootDir.empty() || ninjaExe.empty() || cmakeExe.empty()) {
-        throw std::invalid_argument("usage: --build <msbuild directory> --ninja <ninja binary> --cmake <cmake binary> [--dry] [--verbose] [--deps target=target1,target2... ] ");
+    if (!collationFile.empty())
+        return;
+    if ((rootDir.empty() && batchFile.empty()) || (!check && (ninjaExe.empty() || cmakeExe.empty()))) {
+        throw std::invalid_argument("usage: --build <msbuild directory> | --batch <file with directory list> --ninja <ninja binary> --cmake <cmake binary> [--dry] [--verbose] [--deps target=target1,target2... ] [--platforms platform1,platform2...] [--jobs N] [--scan-includes] [--compiler-launcher <launcher> [--local-jobs N] [--remote-jobs N]] [--z7] [--precise-codegen] [--fast-noop] [--link-profile fast|default] [--streaming | --graph-stats --dot]\n   or: --build <msbuild directory> | --batch <file with directory list> --check");
     }
+    if (streaming && (graphStats || writeDot))
+        throw std::invalid_argument("project graph needs whole model, so it can't be combined with " + g_streamingOption);
     if (dryRun)
         std::cout << "Dry run.\n";
     if (preferredConfig == "Debug")
         configs = StringVector{ "Debug", "Release" };
 
+    if (batchFile.empty())
+        SetBuildDir(rootDir);
+}
+
+void CommandLine::SetBuildDir(const std::string& dir)
+{
+    rootDir = dir;
     StringVector slnFiles;
     for (const fs::directory_entry& it : fs::directory_iterator(rootDir)) {
         const fs::path& p = it.path();
-        if (fs::is_regular_file(p) && p.extension() == ".sln")
+        if (p.extension() == ".sln" && it.is_regular_file()) // build directory is large, so only candidates are stat'ed.
             slnFiles.push_back(p.filename().u8string());
     }
     if (slnFiles.size() != 1)
-        throw std::invalid_argument("directory should contain exactly one sln file");
+        throw std::invalid_argument("directory should contain exactly one sln file: " + rootDir);
 
-    std::replace(rootDir.begin(), rootDir.end(), '/', '\\');
+    ReplaceAll(rootDir, "/", '\\');
     slnFile = slnFiles[0];
 }
@@ -9,10 +9,32 @@ struct CommandLine {
     std::string                         slnFile;
     std::string                         ninjaExe;
     std::string                         cmakeExe;
-    bool                                dryRun  = false;
-    bool                                verbose = false;
+    std::string                         batchFile;
+    std::string                         compilerLauncher; // e.g. sccache; compile steps become distributable.
+    std::string                         moduleCollator;   // command ninja runs to collate C++ modules; empty in-process, so modules are not supported.
+    std::string                         collationFile;    // set when run by ninja to collate modules, instead of conversion.
+    bool                                dryRun         = false;
+    bool                                verbose        = false;
+    bool                                scanIncludes   = false;
+    bool                                embedDebugInfo = false; // /Z7 instead of shared compile pdb.
+    bool                                preciseCodegen = false; // objects wait only for generated headers they include.
+    bool                                fastNoop       = false; // projects build outputs directly, without alias phony targets.
+    bool                                fastLink       = false; // --link-profile fast; default one matches MSBuild.
+    bool                                streaming      = false; // projects are freed once their rules are generated, to bound memory.
+    bool                                check          = false; // only tell if conversion is needed, by exit code.
+    bool                                graphStats     = false; // print report on project graph after conversion.
+    bool                                writeDot       = false; // write project graph for Graphviz after conversion.
+    size_t                              jobs           = 0;     // 0 means number of hardware threads.
+    size_t                              localJobs      = 0;     // ninja pool depth for link and custom steps with launcher, 0 means hardware threads.
+    size_t                              remoteJobs     = 0;     // ninja pool depth for compile steps with launcher, 0 means ninja -j.
     std::map<std::string, StringVector> additionalDeps;
     StringVector                        configs{ "Release", "Debug" }; // order is crucial - Release rules more prioritized on conflict.
+    StringVector                        platforms;                     // empty means all platforms found in projects.
 
+    /// Default settings, for in-process use; fill fields and call SetBuildDir.
+    CommandLine() = default;
     CommandLine(int argc, char* argv[]);
+
+    /// Sets rootDir and finds its only .sln file.
+    void SetBuildDir(const std::string& dir);
 };
@@ -17,11 +17,29 @@
 #include <vector>
 #include <memory>
 #include <ostream>
+#include <string_view>
 #include <stdint.h>
 
 using StringVector = std::vector<std::string>;
 using ByteArray    = std::vector<uint8_t>;
 
+/// FNV-1a hash; fast, stable between runs and platforms. Not for security.
+inline uint64_t FastHash(std::string_view data)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : data) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/// Comparator for string-keyed containers, allowing lookup by any string type (e.g. std::string keys by std::string_view).
+struct StringViewLess {
+    using is_transparent = void;
+    bool operator()(std::string_view l, std::string_view r) const { return l < r; }
+};
+
 inline std::ostream& operator<<(std::ostream& os, const StringVector& lst)
 {
     for (const auto& el : lst)
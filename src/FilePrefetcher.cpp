@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+
+#include "FilePrefetcher.h"
+#include "FileUtils.h"
+
+FilePrefetcher::FilePrefetcher(ThreadPool& ioPool_)
+    : ioPool(ioPool_)
+{}
+
+FilePrefetcher::~FilePrefetcher()
+{
+    for (auto& entry : entries) {
+        if (entry.second.done.valid())
+            entry.second.done.wait();
+    }
+}
+
+void FilePrefetcher::Prefetch(const StringVector& paths)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& path : paths) {
+        auto inserted = entries.emplace(path, Entry());
+        if (!inserted.second)
+            continue;
+        Entry& entry = inserted.first->second;
+        entry.done   = ioPool.Enqueue([&entry, path] { entry.ok = FileInfo(path).ReadFile(entry.data); });
+    }
+}
+
+bool FilePrefetcher::Read(const std::string& path, std::string& data)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    auto                         it = entries.find(path);
+    // entry is read by this thread only, and map nodes are stable, so rest goes without lock.
+    lock.unlock();
+    if (it == entries.end() || !it->second.done.valid())
+        return FileInfo(path).ReadFile(data);
+
+    it->second.done.get();
+    data = std::move(it->second.data);
+    return it->second.ok;
+}
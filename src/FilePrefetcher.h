@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+
+#pragma once
+
+#include "CommonTypes.h"
+#include "ThreadPool.h"
+
+#include <map>
+
+/// Reads whole files in background, all requested up front, so latency of slow (e.g. network) volumes
+/// is hidden behind parsing of files which already arrived. Thread-safe.
+class FilePrefetcher {
+    struct Entry {
+        std::string       data;
+        bool              ok = false;
+        std::future<void> done;
+    };
+    std::mutex                   mutex;
+    std::map<std::string, Entry> entries;
+    ThreadPool&                  ioPool; // shared by all prefetchers, so concurrent conversions do not multiply reading threads.
+
+public:
+    explicit FilePrefetcher(ThreadPool& ioPool_);
+    /// Waits for reads already requested, as they fill entries.
+    ~FilePrefetcher();
+
+    /// Starts reading files, in given order. Files requested later than Read of them are read twice.
+    void Prefetch(const StringVector& paths);
+
+    /// Waits for file to be read and moves its content into data; files not prefetched are read immediately.
+    /// Returns false if file can't be read. Each prefetched file can be read once.
+    bool Read(const std::string& path, std::string& data);
+};
@@ -34,6 +34,8 @@ using fserr  = std::error_code;
 #include <io.h>
 #include <share.h>
 #include <direct.h>
+#else
+#include <unistd.h>
 #endif
 
 namespace {
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+#include "IncludeScanner.h"
+#include "FileUtils.h"
+
+#include <cstring>
+#include <filesystem>
+namespace fs = std::filesystem;
+using fserr  = std::error_code;
+
+namespace {
+
+struct IncludeDirective {
+    std::string name;
+    bool        quoted;
+};
+
+std::vector<IncludeDirective> FindIncludes(const std::string& data)
+{
+    std::vector<IncludeDirective> result;
+    const char*                   begin = data.c_str();
+    const char*                   end   = begin + data.size();
+    const char*                   pos   = begin;
+    // memchr is vectorized by C runtime, so only '#' positions are checked char by char.
+    while ((pos = static_cast<const char*>(memchr(pos, '#', end - pos))) != nullptr) {
+        const char* lineStart = pos;
+        while (lineStart > begin && (lineStart[-1] == ' ' || lineStart[-1] == '\t'))
+            --lineStart;
+        const bool atLineStart = lineStart == begin || lineStart[-1] == '\n' || lineStart[-1] == '\r';
+        ++pos;
+        if (!atLineStart)
+            continue;
+
+        while (pos < end && (*pos == ' ' || *pos == '\t'))
+            ++pos;
+        if (end - pos < 7 || memcmp(pos, "include", 7) != 0)
+            continue;
+        pos += 7;
+        while (pos < end && (*pos == ' ' || *pos == '\t'))
+            ++pos;
+        if (pos == end || (*pos != '"' && *pos != '<'))
+            continue;
+
+        const char  closing = *pos == '"' ? '"' : '>';
+        const char* nameEnd = pos + 1;
+        while (nameEnd < end && *nameEnd != closing && *nameEnd != '\n')
+            ++nameEnd;
+        if (nameEnd == end || *nameEnd != closing)
+            continue;
+        result.push_back({ std::string(pos + 1, nameEnd), closing == '"' });
+        pos = nameEnd;
+    }
+    return result;
+}
+
+/// 0 for missing file, so file created later counts as changed.
+int64_t GetMtime(const std::string& path)
+{
+    fserr      code;
+    const auto time = fs::last_write_time(fs::u8path(path), code);
+    return code ? 0 : int64_t(time.time_since_epoch().count());
+}
+
+}
+
+StringVector IncludeScanner::ScanTransitive(const std::string& source, const StringVector& includeDirs)
+{
+    const size_t          includeListId = GetIncludeListId(includeDirs);
+    StringVector          result;
+    std::set<std::string> visited{ source };
+    StringVector          queue{ source };
+    while (!queue.empty()) {
+        const std::string file = queue.back();
+        queue.pop_back();
+        for (const auto& header : *ScanDirect(file, includeDirs, includeListId)) {
+            if (!visited.insert(header).second)
+                continue;
+            result.push_back(header);
+            queue.push_back(header);
+        }
+    }
+    return result;
+}
+
+size_t IncludeScanner::GetIncludeListId(const StringVector& includeDirs)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return includeListIds.emplace(includeDirs, includeListIds.size()).first->second;
+}
+
+std::shared_ptr<const StringVector> IncludeScanner::ScanDirect(const std::string& file, const StringVector& includeDirs, size_t includeListId)
+{
+    const auto  key = std::make_pair(includeListId, file);
+    ScannedFile cached;
+    size_t      currentPass;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        currentPass = pass;
+        auto it     = directIncludes.find(key);
+        if (it != directIncludes.cend()) {
+            if (it->second.pass == currentPass)
+                return it->second.headers;
+            cached = it->second;
+        }
+    }
+    // stat goes before read, so file changed during read is scanned again next time.
+    const int64_t mtime = GetMtime(file);
+    if (cached.headers && cached.mtime == mtime) {
+        std::lock_guard<std::mutex> lock(mutex);
+        directIncludes[key].pass = currentPass;
+        return cached.headers;
+    }
+
+    std::string data;
+    FileInfo(file).ReadFile(data);
+    const std::string fileDir = fs::path(file).parent_path().u8string();
+
+    StringVector headers;
+    for (const auto& include : FindIncludes(data)) {
+        std::string resolved;
+        if (include.quoted)
+            resolved = Resolve(fileDir, include.name);
+        for (size_t i = 0; resolved.empty() && i < includeDirs.size(); ++i)
+            resolved = Resolve(includeDirs[i], include.name);
+        if (!resolved.empty())
+            headers.push_back(resolved);
+    }
+
+    ScannedFile                 scanned{ mtime, currentPass, std::make_shared<const StringVector>(std::move(headers)) };
+    std::lock_guard<std::mutex> lock(mutex);
+    directIncludes[key] = scanned;
+    return scanned.headers;
+}
+
+void IncludeScanner::Revalidate()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ++pass;
+}
+
+void IncludeScanner::AddGeneratedFiles(const StringVector& files)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& file : files) {
+        const fs::path path = fs::path(file).lexically_normal();
+        generatedFiles[FileInfo::ToPlatformPath(path.parent_path().u8string())].insert(FileInfo::ToPlatformPath(path.filename().u8string()));
+    }
+}
+
+std::string IncludeScanner::NormalizePath(const std::string& path)
+{
+    return FileInfo::ToPlatformPath(fs::path(path).lexically_normal().u8string());
+}
+
+std::string IncludeScanner::Resolve(const std::string& dir, const std::string& include)
+{
+    const fs::path candidate = (fs::path(dir) / include).lexically_normal();
+    if (!FileExists(candidate.parent_path().u8string(), candidate.filename().u8string()))
+        return {};
+    return candidate.u8string();
+}
+
+bool IncludeScanner::FileExists(const std::string& dir, const std::string& name)
+{
+    const std::string dirKey  = FileInfo::ToPlatformPath(dir);
+    const std::string nameKey = FileInfo::ToPlatformPath(name);
+    size_t            currentPass;
+    int64_t           cachedMtime = -1;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        currentPass      = pass;
+        auto generatedIt = generatedFiles.find(dirKey);
+        if (generatedIt != generatedFiles.cend() && generatedIt->second.count(nameKey) > 0)
+            return true;
+        auto it = dirContents.find(dirKey);
+        if (it != dirContents.cend()) {
+            if (it->second.pass == currentPass)
+                return it->second.names.count(nameKey) > 0;
+            cachedMtime = it->second.mtime;
+        }
+    }
+    // creating or removing file changes mtime of its directory.
+    const int64_t mtime = GetMtime(dir);
+    if (mtime == cachedMtime) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ListedDir&                  listed = dirContents[dirKey];
+        listed.pass                        = currentPass;
+        return listed.names.count(nameKey) > 0;
+    }
+
+    ListedDir listed{ mtime, currentPass, {} };
+    fserr     code;
+    for (fs::directory_iterator it(dir, code), end; !code && it != end; it.increment(code)) {
+        if (!it->is_directory(code))
+            listed.names.insert(FileInfo::ToPlatformPath(it->path().filename().u8string()));
+    }
+    const bool exists = listed.names.count(nameKey) > 0;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    dirContents[dirKey] = std::move(listed);
+    return exists;
+}
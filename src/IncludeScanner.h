@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+
+#pragma once
+
+#include "CommonTypes.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+
+/// Finds headers included by source file, without preprocessing: every #include line counts, even under false #if.
+/// Headers not found in include directories (e.g. system ones) are skipped. Thread-safe.
+/// Results are cached; after Revalidate, each cached file or directory is checked by its mtime once, on next use.
+class IncludeScanner {
+    struct ScannedFile {
+        int64_t                             mtime = 0;
+        size_t                              pass  = 0; // in which mtime was checked last.
+        std::shared_ptr<const StringVector> headers;   // shared, as entry may be replaced while other thread still walks it.
+    };
+    struct ListedDir {
+        int64_t               mtime = 0;
+        size_t                pass  = 0;
+        std::set<std::string> names;
+    };
+    std::mutex                                            mutex;
+    size_t                                                pass = 0;
+    std::map<std::string, ListedDir>                      dirContents;
+    std::map<std::string, std::set<std::string>>          generatedFiles;
+    std::map<StringVector, size_t>                        includeListIds; // by content: lists of freed configs may be reallocated at same address.
+    std::map<std::pair<size_t, std::string>, ScannedFile> directIncludes; // by include list id and file.
+
+public:
+    /// Returns all headers included by source, directly or not.
+    StringVector ScanTransitive(const std::string& source, const StringVector& includeDirs);
+
+    /// Makes files produced by build resolvable before they exist; they are scanned as empty.
+    void AddGeneratedFiles(const StringVector& files);
+
+    /// Makes cached results be checked for changed files, as long-lived host edits them between conversions.
+    void Revalidate();
+
+    /// Path form used in scan results, so they can be compared with other paths.
+    static std::string NormalizePath(const std::string& path);
+
+private:
+    size_t              GetIncludeListId(const StringVector& includeDirs);
+    std::shared_ptr<const StringVector> ScanDirect(const std::string& file, const StringVector& includeDirs, size_t includeListId);
+    std::string Resolve(const std::string& dir, const std::string& include);
+    bool        FileExists(const std::string& dir, const std::string& name);
+};
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+
+#include "InputManifest.h"
+#include "FileUtils.h"
+
+#include <cstdlib>
+#include <filesystem>
+#include <sys/stat.h>
+
+namespace {
+const std::string g_manifestVersion = "2";
+
+/// Mtime (in platform units) and size, with best resolution platform has.
+bool StatFile(const std::string& path, int64_t& mtime, uint64_t& size)
+{
+#ifdef _WIN32
+    // _stat64 has whole seconds only, so edits within a second of conversion would be missed.
+    std::error_code      code;
+    const auto           filePath = std::filesystem::u8path(path);
+    const auto           time     = std::filesystem::last_write_time(filePath, code);
+    const std::uintmax_t fileSize = code ? 0 : std::filesystem::file_size(filePath, code);
+    if (code)
+        return false;
+    mtime = time.time_since_epoch().count();
+    size  = fileSize;
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+#ifdef __APPLE__
+    mtime = int64_t(st.st_mtimespec.tv_sec) * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+    mtime = int64_t(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+    size = st.st_size;
+#endif
+    return true;
+}
+}
+
+void InputManifest::Add(const std::string& path, std::string_view data)
+{
+    Entry entry;
+    entry.path = std::filesystem::absolute(path).u8string(); // checks may run from other directory.
+    entry.hash = FastHash(data);
+    StatFile(path, entry.mtime, entry.size);
+    entries.push_back(std::move(entry));
+}
+
+bool InputManifest::Write(const std::string& manifestPath, const std::string& settingsKey) const
+{
+    std::string data = g_manifestVersion + "\n" + settingsKey + "\n";
+    for (const Entry& entry : entries)
+        data += std::to_string(entry.mtime) + " " + std::to_string(entry.size) + " " + std::to_string(entry.hash) + " " + entry.path + "\n";
+    return FileInfo(manifestPath).WriteFile(data);
+}
+
+bool InputManifest::IsStale(const std::string& manifestPath, const std::string& settingsKey)
+{
+    std::string data;
+    if (!FileInfo(manifestPath).ReadFile(data))
+        return true;
+
+    size_t lineEnd = data.find('\n');
+    if (lineEnd == std::string::npos || data.compare(0, lineEnd, g_manifestVersion) != 0)
+        return true;
+    const size_t keyStart = lineEnd + 1;
+    lineEnd               = data.find('\n', keyStart);
+    if (lineEnd == std::string::npos || data.compare(keyStart, lineEnd - keyStart, settingsKey) != 0)
+        return true;
+    for (size_t pos = lineEnd + 1; pos < data.size(); pos = lineEnd + 1) {
+        lineEnd = data.find('\n', pos);
+        if (lineEnd == std::string::npos)
+            return true;
+        // "mtime size hash path", path may contain spaces.
+        char*          end       = nullptr;
+        const int64_t  mtime     = std::strtoll(data.c_str() + pos, &end, 10);
+        const uint64_t size      = std::strtoull(end, &end, 10);
+        const uint64_t hash      = std::strtoull(end, &end, 10);
+        const char*    pathStart = end + 1;
+        if (pathStart >= data.c_str() + lineEnd)
+            return true;
+        const std::string path(pathStart, data.c_str() + lineEnd);
+
+        int64_t  currentMtime = 0;
+        uint64_t currentSize  = 0;
+        if (!StatFile(path, currentMtime, currentSize) || currentSize != size)
+            return true;
+        if (currentMtime == mtime)
+            continue;
+        std::string content;
+        if (!FileInfo(path).ReadFile(content) || FastHash(content) != hash)
+            return true;
+    }
+    return false;
+}
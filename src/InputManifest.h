@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+
+#pragma once
+
+#include "CommonTypes.h"
+
+/// Files read by last conversion, with their size, mtime and content hash,
+/// so staleness of solution can be checked by stat calls only, without parsing anything.
+class InputManifest {
+    struct Entry {
+        std::string path;
+        int64_t     mtime = 0;
+        uint64_t    size  = 0;
+        uint64_t    hash  = 0;
+    };
+    std::vector<Entry> entries;
+
+public:
+    /// Records file with its current content.
+    void Add(const std::string& path, std::string_view data);
+
+    /// settingsKey describes conversion options, as output depends on them too.
+    bool Write(const std::string& manifestPath, const std::string& settingsKey) const;
+
+    /// True if manifest can't be read, was written with other settings or any of its files changed.
+    /// Files with changed stat are hashed, so touched but unchanged ones do not count.
+    static bool IsStale(const std::string& manifestPath, const std::string& settingsKey);
+};
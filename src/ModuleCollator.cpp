@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+#include "ModuleCollator.h"
+#include "FileUtils.h"
+#include "StringKernels.h"
+#include "VariableMap.h"
+
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+namespace {
+const std::string g_dyndepKey     = "dyndep";
+const std::string g_modulesKey    = "modules";
+const std::string g_ifcDirKey     = "ifc-dir";
+const std::string g_depModulesKey = "dep-modules";
+const std::string g_objectKey     = "object";
+
+/// JSON value, enough for P1689 scan results.
+struct JsonValue {
+    enum class Kind
+    {
+        Null,
+        Bool,
+        Number,
+        String,
+        Array,
+        Object
+    };
+    Kind                             kind    = Kind::Null;
+    bool                             boolean = false;
+    std::string                      text; // of string, or number as written.
+    std::vector<JsonValue>           items;
+    std::map<std::string, JsonValue> members;
+
+    const JsonValue* Find(const std::string& key) const
+    {
+        auto it = members.find(key);
+        return it == members.cend() ? nullptr : &it->second;
+    }
+    const std::vector<JsonValue>& Items(const std::string& key) const
+    {
+        static const std::vector<JsonValue> none;
+        const JsonValue*                    value = Find(key);
+        return value && value->kind == Kind::Array ? value->items : none;
+    }
+    std::string Text(const std::string& key) const
+    {
+        const JsonValue* value = Find(key);
+        return value && value->kind == Kind::String ? value->text : std::string();
+    }
+};
+
+class JsonParser {
+    const std::string& data;
+    size_t             pos = 0;
+
+public:
+    explicit JsonParser(const std::string& data_)
+        : data(data_)
+    {}
+
+    JsonValue ParseDocument()
+    {
+        JsonValue value = ParseValue();
+        SkipSpace();
+        if (pos != data.size())
+            Fail();
+        return value;
+    }
+
+private:
+    [[noreturn]] void Fail() const { throw std::runtime_error("invalid JSON at offset " + std::to_string(pos)); }
+
+    void SkipSpace()
+    {
+        while (pos < data.size() && std::isspace(static_cast<unsigned char>(data[pos])))
+            ++pos;
+    }
+    bool Consume(char c)
+    {
+        SkipSpace();
+        if (pos == data.size() || data[pos] != c)
+            return false;
+        ++pos;
+        return true;
+    }
+    void Expect(char c)
+    {
+        if (!Consume(c))
+            Fail();
+    }
+    bool ConsumeWord(const char* word)
+    {
+        const size_t size = strlen(word);
+        if (data.compare(pos, size, word) != 0)
+            return false;
+        pos += size;
+        return true;
+    }
+
+    JsonValue ParseValue()
+    {
+        JsonValue value;
+        if (Consume('{')) {
+            value.kind = JsonValue::Kind::Object;
+            if (Consume('}'))
+                return value;
+            do {
+                SkipSpace();
+                std::string key = ParseString();
+                Expect(':');
+                value.members[key] = ParseValue();
+            } while (Consume(','));
+            Expect('}');
+        } else if (Consume('[')) {
+            value.kind = JsonValue::Kind::Array;
+            if (Consume(']'))
+                return value;
+            do {
+                value.items.push_back(ParseValue());
+            } while (Consume(','));
+            Expect(']');
+        } else if (pos < data.size() && data[pos] == '"') {
+            value.kind = JsonValue::Kind::String;
+            value.text = ParseString();
+        } else if (ConsumeWord("true")) {
+            value.kind    = JsonValue::Kind::Bool;
+            value.boolean = true;
+        } else if (ConsumeWord("false")) {
+            value.kind = JsonValue::Kind::Bool;
+        } else if (ConsumeWord("null")) {
+        } else {
+            const size_t start = pos;
+            while (pos < data.size() && data[pos] && strchr("+-.0123456789eE", data[pos]))
+                ++pos;
+            if (pos == start)
+                Fail();
+            value.kind = JsonValue::Kind::Number;
+            value.text = data.substr(start, pos - start);
+        }
+        return value;
+    }
+
+    std::string ParseString()
+    {
+        if (pos == data.size() || data[pos] != '"')
+            Fail();
+        ++pos;
+        std::string result;
+        while (pos < data.size() && data[pos] != '"') {
+            const char c = data[pos++];
+            if (c != '\\') {
+                result += c;
+                continue;
+            }
+            if (pos == data.size())
+                Fail();
+            const char  escaped = data[pos++];
+            const char* simple  = strchr("\"\\/bfnrt", escaped);
+            if (simple && escaped) {
+                result += "\"\\/\b\f\n\r\t"[simple - "\"\\/bfnrt"];
+                continue;
+            }
+            if (escaped != 'u')
+                Fail();
+            uint32_t code = ParseHex4();
+            if (code >= 0xD800 && code < 0xDC00 && ConsumeWord("\\u"))
+                code = 0x10000 + ((code - 0xD800) << 10) + (ParseHex4() - 0xDC00);
+            AppendUtf8(result, code);
+        }
+        if (pos == data.size())
+            Fail();
+        ++pos;
+        return result;
+    }
+
+    uint32_t ParseHex4()
+    {
+        if (pos + 4 > data.size())
+            Fail();
+        const std::string hex = data.substr(pos, 4);
+        char*             end = nullptr;
+        const uint32_t    code = static_cast<uint32_t>(std::strtoul(hex.c_str(), &end, 16));
+        if (end != hex.c_str() + 4)
+            Fail();
+        pos += 4;
+        return code;
+    }
+
+    static void AppendUtf8(std::string& out, uint32_t code)
+    {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        } else if (code < 0x800) {
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+};
+
+std::string readFile(const std::string& path)
+{
+    std::string data;
+    if (!FileInfo(path).ReadFile(data))
+        throw std::runtime_error("Failed to read file:" + path);
+    return data;
+}
+
+/// Unchanged file keeps its timestamp, so edges restating it are not run again.
+void writeIfChanged(const std::string& path, const std::string& data)
+{
+    FileInfo    file(path);
+    std::string existing;
+    if (file.ReadFile(existing) && existing == data)
+        return;
+    if (!file.WriteFile(data))
+        throw std::runtime_error("Failed to write file:" + path);
+}
+
+std::string ninjaEscape(const std::string& path)
+{
+    return EscapeAll(path, "$ :", '$');
+}
+
+std::string quoteArgument(const std::string& value)
+{
+    return value.find(' ') == std::string::npos ? value : '"' + value + '"';
+}
+}
+
+std::string ModuleCollation::Serialize() const
+{
+    std::string result = g_dyndepKey + " " + dyndepFile + "\n" + g_modulesKey + " " + modulesFile + "\n" + g_ifcDirKey + " " + ifcDir + "\n";
+    for (const auto& file : depModulesFiles)
+        result += g_depModulesKey + " " + file + "\n";
+    for (const auto& object : objects)
+        result += g_objectKey + " " + object + "\n";
+    return result;
+}
+
+void ModuleCollation::Load(const std::string& path)
+{
+    for (const auto& line : strToList(readFile(path), '\n')) {
+        const size_t      space = line.find(' ');
+        const std::string key   = line.substr(0, space);
+        const std::string value = space == std::string::npos ? std::string() : line.substr(space + 1);
+        if (key == g_dyndepKey)
+            dyndepFile = value;
+        else if (key == g_modulesKey)
+            modulesFile = value;
+        else if (key == g_ifcDirKey)
+            ifcDir = value;
+        else if (key == g_depModulesKey)
+            depModulesFiles.push_back(value);
+        else if (key == g_objectKey)
+            objects.push_back(value);
+        else
+            throw std::runtime_error("Unknown module collation entry: " + line);
+    }
+    if (dyndepFile.empty() || modulesFile.empty())
+        throw std::runtime_error("Module collation has no output files");
+}
+
+void ModuleCollation::Run() const
+{
+    // dependencies list modules of their own dependencies too, so direct ones are enough.
+    std::map<std::string, std::string> ifcs;
+    for (const auto& file : depModulesFiles) {
+        for (const auto& line : strToList(readFile(file), '\n')) {
+            const size_t space = line.find(' ');
+            if (space != std::string::npos)
+                ifcs[line.substr(0, space)] = line.substr(space + 1);
+        }
+    }
+
+    struct Unit {
+        std::vector<std::pair<std::string, bool>> provides; // module, is interface.
+        StringVector                              imports;
+    };
+    std::vector<Unit>                  units(objects.size());
+    std::map<std::string, std::string> providers;
+    for (size_t i = 0; i < objects.size(); ++i) {
+        const std::string scanFile = ScanFile(objects[i]);
+        JsonValue         scan;
+        try {
+            scan = JsonParser(readFile(scanFile)).ParseDocument();
+        }
+        catch (std::exception& e) {
+            throw std::runtime_error("Broken scan result " + scanFile + ": " + e.what());
+        }
+        for (const auto& rule : scan.Items("rules")) {
+            for (const auto& provided : rule.Items("provides")) {
+                const std::string name = provided.Text("logical-name");
+                if (name.empty())
+                    continue;
+                const JsonValue* isInterface = provided.Find("is-interface");
+                units[i].provides.emplace_back(name, !isInterface || isInterface->boolean);
+                if (!providers.emplace(name, objects[i]).second)
+                    throw std::runtime_error("Module " + name + " is provided by both " + providers[name] + " and " + objects[i]);
+                // partitions are named "module:partition", which is not a valid file name.
+                std::string ifcName = name;
+                ReplaceAll(ifcName, ":", '-');
+                ifcs[name] = ifcDir + ifcName + ".ifc";
+            }
+            // header units are looked up as includes; they are left to compiler, like modules of no known target.
+            for (const auto& required : rule.Items("requires")) {
+                const std::string lookup = required.Text("lookup-method");
+                if (lookup.empty() || lookup == "by-name")
+                    units[i].imports.push_back(required.Text("logical-name"));
+            }
+        }
+    }
+
+    std::string modulesData;
+    for (const auto& ifc : ifcs)
+        modulesData += ifc.first + " " + ifc.second + "\n";
+
+    std::string dyndepData = "ninja_dyndep_version = 1\n";
+    for (size_t i = 0; i < objects.size(); ++i) {
+        std::string moduleMap, outputs, inputs;
+        for (const auto& provided : units[i].provides) {
+            const std::string& ifc = ifcs[provided.first];
+            moduleMap += (provided.second ? "/interface\n" : "/internalPartition\n");
+            moduleMap += "/ifcOutput " + quoteArgument(ifc) + "\n";
+            outputs += " " + ninjaEscape(ifc);
+        }
+        for (const auto& name : units[i].imports) {
+            auto it = ifcs.find(name);
+            if (it == ifcs.cend())
+                continue;
+            moduleMap += "/reference " + quoteArgument(name + "=" + it->second) + "\n";
+            inputs += " " + ninjaEscape(it->second);
+        }
+        dyndepData += "build " + ninjaEscape(objects[i]) + (outputs.empty() ? "" : " |" + outputs) + ": dyndep" + (inputs.empty() ? "" : " |" + inputs) + "\n";
+        writeIfChanged(ModuleMapFile(objects[i]), moduleMap);
+    }
+    writeIfChanged(modulesFile, modulesData);
+    writeIfChanged(dyndepFile, dyndepData);
+}
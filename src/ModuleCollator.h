@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+
+#pragma once
+
+#include "CommonTypes.h"
+
+/// C++20 modules of one target config: ninja scans every source into P1689 JSON ("<object>.ddi"), then runs
+/// msbuild2ninja --collate-modules with this description, which writes the rest:
+/// ninja dyndep file with .ifc outputs and inputs of objects, "<object>.modmap" response file of each object
+/// with /ifcOutput and /reference options, and list of modules of target and its dependencies for dependent targets.
+struct ModuleCollation {
+    std::string  dyndepFile;
+    std::string  modulesFile;     // "<module> <ifc>" per line.
+    std::string  ifcDir;          // where modules of target are compiled to.
+    StringVector depModulesFiles; // of direct dependencies; they already include modules of their own dependencies.
+    StringVector objects;         // as named in build.ninja.
+
+    static std::string ScanFile(const std::string& object) { return object + ".ddi"; }
+    static std::string ModuleMapFile(const std::string& object) { return object + ".modmap"; }
+
+    std::string Serialize() const;
+    /// Reads description written by Serialize. Throws on unreadable or malformed file.
+    void Load(const std::string& path);
+
+    /// Reads scan results and writes output files, each only if its content changed, so ninja can restat them.
+    /// Throws on unreadable scan result or module provided twice; modules not found are left to compiler search.
+    void Run() const;
+};
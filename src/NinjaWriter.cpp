@@ -1,35 +1,215 @@
 #include "NinjaWriter.h"
 #include "FileUtils.h"
 #include "VcProjectInfo.h"
+#include "IncludeScanner.h"
+#include "ThreadPool.h"
+#include "StringKernels.h"
+#include "ModuleCollator.h"
 
-#include <regex>
 #include <iostream>
 #include <cassert>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <filesystem>
+namespace fs = std::filesystem;
+using fserr  = std::error_code;
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
 
 namespace {
-std::string AddQuotes(const std::string& str)
+const size_t      g_maxCommandLength = 2000; // do not support NT 4
+const std::string g_spillFileName    = "build.ninja.rules.tmp";
+
+/// Timestamp in the same units ninja uses in its logs, 0 for missing file.
+int64_t GetNinjaMtime(const std::string& path)
+{
+#ifdef _WIN32
+    fserr      code;
+    const auto time = fs::last_write_time(path, code);
+    if (code)
+        return 0;
+    return time.time_since_epoch().count() - 12622770400LL * (1000000000LL / 100); // FILETIME, moved from 1601 to 2000 epoch.
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return 0;
+#ifdef __APPLE__
+    return int64_t(st.st_mtimespec.tv_sec) * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+    return int64_t(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+#endif
+}
+
+/// Node path as ninja stores it in logs.
+std::string NinjaCanonicalPath(std::string path)
 {
-    const bool hasSpaces = str.find(' ') != std::string::npos;
-    return hasSpaces ? "\"" + str + "\"" : str;
+    ReplaceAll(path, "\\", '/');
+    return fs::path(path).lexically_normal().generic_u8string();
 }
+
+std::string ToHex(uint64_t value)
+{
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(value));
+    return buffer;
+}
+
+void AppendUint32(std::string& out, uint32_t value)
+{
+    char buffer[4];
+    memcpy(buffer, &value, 4);
+    out.append(buffer, 4);
+}
+
+/// Header path as ninja records it from /showIncludes (IncludesNormalize): relative to build root when on same drive.
+std::string NinjaIncludePath(const std::string& path, const StringVector& buildRootParts)
+{
+    const std::string canonical = NinjaCanonicalPath(path);
+    auto              hasDrive  = [](const std::string& value) { return value.size() >= 2 && value[1] == ':'; };
+    if (buildRootParts.empty() || !hasDrive(canonical) || !hasDrive(buildRootParts[0]) || ::tolower(canonical[0]) != ::tolower(buildRootParts[0][0]))
+        return canonical;
+
+    auto equalNoCase = [](const std::string& l, const std::string& r) {
+        return l.size() == r.size() && std::equal(l.cbegin(), l.cend(), r.cbegin(), [](char a, char b) { return ::tolower(a) == ::tolower(b); });
+    };
+    const StringVector parts  = strToList(canonical, '/');
+    size_t             common = 0;
+    while (common < parts.size() && common < buildRootParts.size() && equalNoCase(parts[common], buildRootParts[common]))
+        ++common;
+    std::string result;
+    for (size_t i = common; i < buildRootParts.size(); ++i)
+        result += "../";
+    for (size_t i = common; i < parts.size(); ++i)
+        result += parts[i] + "/";
+    if (result.empty())
+        return ".";
+    result.pop_back();
+    return result;
+}
+
+/// Hash ninja keeps for command of each output in .ninja_log v5 (MurmurHash64A).
+uint64_t NinjaCommandHash(std::string_view command)
+{
+    const uint64_t m    = 0xc6a4a7935bd1e995ULL;
+    const int      r    = 47;
+    size_t         len  = command.size();
+    uint64_t       h    = 0xDECAFBADDECAFBADULL ^ (len * m);
+    auto           data = reinterpret_cast<const unsigned char*>(command.data());
+    for (; len >= 8; data += 8, len -= 8) {
+        uint64_t k;
+        memcpy(&k, data, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    if (len) {
+        for (size_t i = 0; i < len; ++i)
+            h ^= uint64_t(data[i]) << (8 * i);
+        h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+/// Path as ninja puts it into $in and $out of Windows commands.
+std::string NinjaCommandPath(const std::string& path)
+{
+    if (path.find_first_of(" \"") == std::string::npos)
+        return path;
+    std::string result      = "\"";
+    size_t      backslashes = 0;
+    for (char c : path) {
+        if (c == '"')
+            result.append(backslashes + 1, '\\');
+        backslashes = c == '\\' ? backslashes + 1 : 0;
+        result += c;
+    }
+    result.append(backslashes, '\\');
+    return result + "\"";
+}
+
+/// Evaluates ninja text with "$name" references and "$$", "$ ", "$:" escapes, as ninja does for commands and bindings.
+template<class Lookup>
+std::string EvaluateNinjaText(std::string_view text, const Lookup& lookup)
+{
+    std::string result;
+    result.reserve(text.size());
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] != '$' || i + 1 == text.size()) {
+            result += text[i];
+            continue;
+        }
+        const char next = text[++i];
+        if (next == '$' || next == ' ' || next == ':') {
+            result += next;
+            continue;
+        }
+        size_t end = i;
+        while (end < text.size() && (::isalnum(static_cast<unsigned char>(text[end])) || text[end] == '_' || text[end] == '-'))
+            ++end;
+        result += lookup(text.substr(i, end - i));
+        i = end - 1;
+    }
+    return result;
+}
+}
+
+NinjaWriter::NinjaWriter(const std::string& buildRoot_, const std::string& cmakeExe_, const Options& options_)
+    : buildRoot(buildRoot_)
+    , cmakeExe(cmakeExe_)
+    , options(options_)
+{
+    if (options.spillRules) {
+        spillFile.open(fs::u8path(buildRoot + "/" + g_spillFileName), std::ios::binary | std::ios::trunc);
+        if (!spillFile)
+            throw std::runtime_error("Failed to write file:" + g_spillFileName);
+    }
+}
+
+NinjaWriter::~NinjaWriter()
+{
+    if (spillFile.is_open()) {
+        spillFile.close();
+        fserr code;
+        fs::remove(fs::u8path(buildRoot + "/" + g_spillFileName), code);
+    }
 }
 
 std::string NinjaWriter::Escape(std::string value)
 {
-    if (value.find(buildRoot) == 0)
+    if (value.compare(0, buildRoot.size(), buildRoot) == 0)
         value = value.substr(buildRoot.size() + 1);
 
-    if (value.find('(') != std::string::npos || value.find(')') != std::string::npos) {
-        auto it = idents.find(value);
-        if (it != idents.cend())
-            return "$" + it->second;
-        const std::string newIdent = "ident" + std::to_string(maxIdent++);
-        identsDecl << newIdent << " = " << value << "\n";
-        idents[value] = newIdent;
-        return "$" + newIdent;
+    const size_t special = FindFirstOf(value, " :()");
+    if (special == std::string::npos)
+        return value;
+    if (FindFirstOf(value, "()", special) != std::string::npos) {
+        return idents.Update(value, [this, &value](auto& shardIdents) {
+            auto it = shardIdents.find(value);
+            if (it != shardIdents.cend())
+                return "$" + it->second;
+            // name comes from value itself; on (practically impossible) collision value is rehashed with salt.
+            std::string                 newIdent = "ident" + ToHex(FastHash(value));
+            std::lock_guard<std::mutex> lock(identNamesMutex);
+            for (int salt = 1; identNames.find(newIdent) != identNames.cend(); ++salt)
+                newIdent = "ident" + ToHex(FastHash(value + '\0' + std::to_string(salt)));
+            identNames.emplace(newIdent);
+            shardIdents.emplace(value, newIdent);
+            return "$" + newIdent;
+        });
     }
-    static const std::regex re("([ ]|[:])", std::regex_constants::ECMAScript | std::regex_constants::optimize);
-    return std::regex_replace(value, re, "$$$1"); // "$$" converts to "$" symbol, and $1 captures 1 match.
+    return EscapeAll(value, " :", '$');
 }
 
 std::string NinjaWriter::Escape(const StringVector& values)
@@ -41,26 +221,57 @@ std::string NinjaWriter::Escape(const StringVector& values)
     return result;
 }
 
-void NinjaWriter::WriteFile(bool verbose) const
+std::string NinjaWriter::CompileCommand(bool useRsp) const
+{
+    // launcher path may contain spaces, so it is quoted as cmake is in link rules.
+    const std::string& launcher = options.compilerLauncher;
+    const std::string  compiler = launcher.empty() ? "cl.exe" : (launcher[0] == '"' ? launcher : "\"" + launcher + "\"") + " cl.exe";
+    const std::string pdbFlags = options.embedDebugInfo ? "" : " /Fd$TARGET_COMPILE_PDB /FS";
+    return compiler + "  /nologo " + (useRsp ? "@$COMPILE_RSP_FILE" : "$DEFINES $INCLUDES $FLAGS") + " /showIncludes /Fo$out" + pdbFlags + " -c $in";
+}
+
+void NinjaWriter::Write(std::ostream& ninjaHeader) const
 {
-    std::ostringstream ninjaHeader;
-    ninjaHeader << "ninja_required_version = 1.5\n";
+    // with launcher compile steps may run anywhere, while link and custom steps are kept to local cores.
+    const bool        distributed = !options.compilerLauncher.empty();
+    const std::string pdbFlags    = options.embedDebugInfo ? "" : " /Fd$TARGET_COMPILE_PDB /FS";
+    const std::string compilePool = distributed && options.remoteJobs ? "  pool = compile_pool\n" : "";
+    const std::string localPool   = distributed ? "  pool = local_pool\n" : "";
+
+    // implicit outputs need 1.7, dyndep needs 1.10.
+    const bool hasModules = !moduleLists.empty();
+    ninjaHeader << "ninja_required_version = " << (hasModules ? "1.10" : options.fastLink ? "1.7" : "1.5") << "\n";
+    if (distributed) {
+        ninjaHeader << "pool local_pool\n  depth = " << options.localJobs << "\n";
+        if (options.remoteJobs)
+            ninjaHeader << "pool compile_pool\n  depth = " << options.remoteJobs << "\n";
+    }
     ninjaHeader << "msvc_deps_prefix = Note: including file: \n";
     ninjaHeader << "rule CXX_COMPILER\n"
                    "  deps = msvc\n"
-                   "  command = cl.exe  /nologo $DEFINES $INCLUDES $FLAGS /showIncludes /Fo$out /Fd$TARGET_COMPILE_PDB /FS -c $in\n"
-                   "  description = Building CXX object $out\n\n";
+                   "  command = "
+                << CompileCommand(false) << "\n"
+                                            "  description = Building CXX object $out\n"
+                << compilePool << "\n";
+
+    ninjaHeader << "rule CXX_COMPILER_RSP\n"
+                   "  deps = msvc\n"
+                   "  command = "
+                << CompileCommand(true) << "\n"
+                                           "  description = Building CXX object $out\n"
+                << compilePool << "\n";
 
     ninjaHeader << "rule CXX_STATIC_LIBRARY_LINKER\n"
                    "  command = cmd.exe /C \"$PRE_LINK && link.exe /lib /nologo $LINK_FLAGS /out:\"$TARGET_FILE\" $in  && $POST_BUILD\"\n"
                    "  description = Linking CXX static library $TARGET_FILE\n"
-                   "  restat = $RESTAT\n";
+                << localPool;
 
     ninjaHeader << "rule CXX_SHARED_LIBRARY_LINKER\n"
                    "  command = cmd.exe /C \"$PRE_LINK && \""
                 << cmakeExe << "\" -E vs_link_dll --intdir=$OBJECT_DIR --manifests $MANIFESTS -- link.exe /nologo $in  /out:\"$TARGET_FILE\" /implib:\"$TARGET_IMPLIB\" /pdb:\"$TARGET_PDB\" /dll /version:0.0 $LINK_FLAGS $LINK_PATH $LINK_LIBRARIES  && $POST_BUILD\"\n"
                                "  description = Linking CXX shared library $TARGET_FILE\n"
-                               "  restat = 1\n";
+                               "  restat = 1\n"
+                << localPool;
 
     ninjaHeader << "rule CXX_SHARED_LIBRARY_LINKER_RSP\n"
                    "  command = cmd.exe /C \"$PRE_LINK && \""
@@ -68,13 +279,14 @@ void NinjaWriter::WriteFile(bool verbose) const
                                "  description = Linking CXX shared library $TARGET_FILE\n"
                                "  rspfile = $RSP_FILE\n"
                                "  rspfile_content = $in_newline $LINK_PATH $LINK_LIBRARIES \n"
-                               "  restat = 1\n";
+                               "  restat = 1\n"
+                << localPool;
 
     ninjaHeader << "rule CXX_EXECUTABLE_LINKER\n"
                    "  command = cmd.exe /C \"$PRE_LINK && \""
                 << cmakeExe << "\" -E vs_link_exe --intdir=$OBJECT_DIR --manifests $MANIFESTS -- link.exe /nologo $in  /out:\"$TARGET_FILE\" /pdb:\"$TARGET_PDB\" /version:0.0  $LINK_FLAGS $LINK_PATH $LINK_LIBRARIES && $POST_BUILD\"\n"
                                "  description = Linking CXX executable $TARGET_FILE\n"
-                               "  restat = $RESTAT\n";
+                << localPool;
 
     ninjaHeader << "rule CXX_EXECUTABLE_LINKER_RSP\n"
                    "  command = cmd.exe /C \"$PRE_LINK && \""
@@ -82,163 +294,526 @@ void NinjaWriter::WriteFile(bool verbose) const
                                "  rspfile = $RSP_FILE\n"
                                "  rspfile_content = $in_newline $LINK_PATH $LINK_LIBRARIES \n"
                                "  description = Linking CXX executable $TARGET_FILE\n"
-                               "  restat = $RESTAT\n";
+                << localPool;
 
     ninjaHeader << "rule CUSTOM_COMMAND\n"
                    "  command = $COMMAND\n"
-                   "  description = $DESC\n";
+                   "  description = $DESC\n"
+                   "  restat = 1\n"
+                << localPool;
 
     ninjaHeader << "rule RC_COMPILER\n"
                    "  command = rc.exe $DEFINES $INCLUDES $FLAGS /fo$out $in\n"
-                   "  description = Building RC object $out\n";
+                   "  description = Building RC object $out\n"
+                << localPool;
+
+    // module units need .ifc files of this machine, so they are scanned and compiled locally, without launcher.
+    if (hasModules) {
+        ninjaHeader << "rule CXX_MODULE_SCAN\n"
+                       "  deps = msvc\n"
+                       "  command = cl.exe  /nologo $DEFINES $INCLUDES $FLAGS /showIncludes /TP /scanDependencies $out /Fo$OBJ_FILE $in\n"
+                       "  description = Scanning CXX source $in\n\n";
+
+        ninjaHeader << "rule CXX_MODULE_SCAN_RSP\n"
+                       "  deps = msvc\n"
+                       "  command = cl.exe  /nologo @$COMPILE_RSP_FILE /showIncludes /TP /scanDependencies $out /Fo$OBJ_FILE $in\n"
+                       "  description = Scanning CXX source $in\n\n";
+
+        ninjaHeader << "rule CXX_MODULE_COLLATE\n"
+                       "  command = "
+                    << options.moduleCollator << " $COLLATION\n"
+                                                 "  description = Collating CXX modules of $COLLATION\n"
+                                                 "  restat = 1\n\n";
 
-    const std::string buildNinja = ninjaHeader.str() + identsDecl.str() + targetRules.str();
-    if (verbose)
-        std::cout << "\nNinja file:\n"
-                  << buildNinja;
+        ninjaHeader << "rule CXX_COMPILER_MODULE\n"
+                       "  deps = msvc\n"
+                       "  command = cl.exe  /nologo $DEFINES $INCLUDES $FLAGS @$MODULE_MAP /showIncludes /Fo$out"
+                    << pdbFlags << " -c $in\n"
+                                   "  description = Building CXX object $out\n"
+                    << localPool << "\n";
 
-    FileInfo(buildRoot + "/build.ninja").WriteFile(buildNinja, false);
+        ninjaHeader << "rule CXX_COMPILER_MODULE_RSP\n"
+                       "  deps = msvc\n"
+                       "  command = cl.exe  /nologo @$COMPILE_RSP_FILE @$MODULE_MAP /showIncludes /Fo$out"
+                    << pdbFlags << " -c $in\n"
+                                   "  description = Building CXX object $out\n"
+                    << localPool << "\n";
+    }
+
+    for (const auto* ident : idents.GetSorted())
+        ninjaHeader << ident->second << " = " << ident->first << "\n";
+    for (const auto* rule : customRules.GetSorted())
+        ninjaHeader << rule->second.second;
+    for (const auto& rules : targetRules)
+        ninjaHeader << rules.second;
+    if (spilledRules.empty())
+        return;
+    std::ifstream spilled(fs::u8path(buildRoot + "/" + g_spillFileName), std::ios::binary);
+    std::string   buffer;
+    for (const auto& rules : spilledRules) {
+        buffer.resize(rules.second.second);
+        spilled.seekg(rules.second.first);
+        if (!spilled.read(&buffer[0], buffer.size()))
+            throw std::runtime_error("Failed to read file:" + g_spillFileName);
+        ninjaHeader << buffer;
+    }
+}
+
+void NinjaWriter::WriteFile(bool verbose) const
+{
+    // streamed, so whole file is never held in memory.
+    std::ofstream ninjaFile(fs::u8path(buildRoot + "/build.ninja"), std::ios::binary | std::ios::trunc);
+    Write(ninjaFile);
+    if (!ninjaFile.flush())
+        throw std::runtime_error("Failed to write file: build.ninja");
+    if (verbose) {
+        std::cout << "\nNinja file:\n";
+        Write(std::cout);
+    }
+    WriteAuxiliaryFiles();
+}
+
+void NinjaWriter::WriteAuxiliaryFiles() const
+{
+    for (const auto& rsp : responseFiles) {
+        FileInfo    rspFile(buildRoot + "/" + rsp.first);
+        std::string existingContent;
+        if (rspFile.ReadFile(existingContent) && existingContent == rsp.second)
+            continue;
+        FileInfo(rspFile.GetDir()).Mkdirs();
+        if (!rspFile.WriteFile(rsp.second))
+            throw std::runtime_error("Failed to write file:" + rsp.first);
+    }
+}
+
+void NinjaWriter::PreseedDepsLog(ThreadPool& pool, IncludeScanner& scanner) const
+{
+    FileInfo depsLog(buildRoot + "/.ninja_deps");
+    FileInfo buildLog(buildRoot + "/.ninja_log");
+    if (depsLog.Exists() || buildLog.Exists())
+        return;
+
+    std::vector<std::pair<const CompileUnit*, int64_t>> builtUnits;
+    for (const auto& unit : compileUnits) {
+        const int64_t mtime = GetNinjaMtime(buildRoot + "/" + unit.objectPath);
+        if (mtime)
+            builtUnits.emplace_back(&unit, mtime);
+    }
+    if (builtUnits.empty())
+        return;
+    std::sort(builtUnits.begin(), builtUnits.end(), [](const auto& l, const auto& r) { return l.first->objectPath < r.first->objectPath; });
+
+    std::vector<StringVector>      headers(builtUnits.size());
+    std::vector<std::future<void>> scans;
+    for (size_t i = 0; i < builtUnits.size(); ++i) {
+        scans.push_back(pool.Enqueue([&scanner, &headers, &builtUnits, i] {
+            const CompileUnit& unit = *builtUnits[i].first;
+            headers[i]              = scanner.ScanTransitive(unit.sourcePath, *unit.includeDirs);
+        }));
+    }
+    for (auto& scan : scans)
+        scan.get();
+
+    // format: header, version, then records; path record gets next node id, deps record refers to ids.
+    std::string                data = "# ninjadeps\n";
+    std::map<std::string, int> nodeIds;
+    AppendUint32(data, 4);
+    auto getNodeId = [&data, &nodeIds](const std::string& canonical) {
+        auto              it        = nodeIds.find(canonical);
+        if (it != nodeIds.cend())
+            return it->second;
+        const int id      = static_cast<int>(nodeIds.size());
+        const size_t padding = (4 - canonical.size() % 4) % 4;
+        AppendUint32(data, static_cast<uint32_t>(canonical.size() + padding + 4));
+        data += canonical;
+        data.append(padding, '\0');
+        AppendUint32(data, ~static_cast<uint32_t>(id));
+        nodeIds[canonical] = id;
+        return id;
+    };
+    // ninja would keep headers relative to build root, so same ids are found when it records them itself.
+    const StringVector buildRootParts = strToList(NinjaCanonicalPath(fs::absolute(fs::u8path(buildRoot)).u8string()), '/');
+    std::string        logData        = "# ninja log v5\n";
+    for (size_t i = 0; i < builtUnits.size(); ++i) {
+        std::vector<int>  inputIds;
+        const std::string output   = NinjaCanonicalPath(builtUnits[i].first->objectPath);
+        const int         outputId = getNodeId(output);
+        for (const auto& header : headers[i])
+            inputIds.push_back(getNodeId(NinjaIncludePath(header, buildRootParts)));
+
+        const int64_t mtime = builtUnits[i].second;
+        AppendUint32(data, static_cast<uint32_t>(4 + 8 + 4 * inputIds.size()) | 0x80000000u);
+        AppendUint32(data, static_cast<uint32_t>(outputId));
+        AppendUint32(data, static_cast<uint32_t>(mtime & 0xffffffff));
+        AppendUint32(data, static_cast<uint32_t>(uint64_t(mtime) >> 32));
+        for (int id : inputIds)
+            AppendUint32(data, static_cast<uint32_t>(id));
+
+        // format: start, end, mtime, output, command hash; without entry ninja rebuilds output as new command.
+        char hash[17];
+        snprintf(hash, sizeof(hash), "%llx", static_cast<unsigned long long>(builtUnits[i].first->commandHash));
+        logData += "0\t0\t" + std::to_string(mtime) + "\t" + output + "\t" + hash + "\n";
+    }
+    if (!depsLog.WriteFile(data))
+        throw std::runtime_error("Failed to write file: .ninja_deps");
+    if (!buildLog.WriteFile(logData))
+        throw std::runtime_error("Failed to write file: .ninja_log");
 }
 
 void NinjaWriter::GenerateNinjaRules(const VcProjectInfo& project)
 {
-    std::ostringstream ss;
+    std::string ss;
     using Type       = VcProjectInfo::Type;
     const auto& type = project.type;
     if (type == Type::Unknown)
         return;
 
-    std::set<std::string> existingObjNames;
-    auto                  getObjectName = [&existingObjNames](const std::string& filename, const std::string& intDir) {
-        static const std::regex re("\\.(cpp|rc)$", std::regex_constants::ECMAScript | std::regex_constants::optimize);
-        std::string             objName = filename.substr(filename.rfind("\\") + 1);
-        objName                         = std::regex_replace(objName, re, ".obj");
-        std::string fullObjName         = intDir + objName;
-        int         prefix              = 1;
-        while (existingObjNames.find(fullObjName) != existingObjNames.end()) {
-            fullObjName = intDir + std::to_string(prefix++) + "_" + objName;
-        }
-        existingObjNames.insert(fullObjName);
-        return fullObjName;
+    auto getShortObjectName = [](const std::string& filename) {
+        const std::string_view name = std::string_view(filename).substr(filename.rfind('\\') + 1);
+        for (const std::string_view ext : { std::string_view(".cpp"), std::string_view(".ixx"), std::string_view(".rc") }) {
+            if (name.size() >= ext.size() && name.substr(name.size() - ext.size()) == ext)
+                return std::string(name.substr(0, name.size() - ext.size())) + ".obj";
+        }
+        return std::string(name);
+    };
+    // sources sharing file name all get prefix from their path, so adding or reordering files does not rename others.
+    std::unordered_map<std::string, int> objNameCounts;
+    objNameCounts.reserve(project.clCompileFiles.size() + project.rcCompileFiles.size());
+    for (const auto* files : { &project.clCompileFiles, &project.rcCompileFiles }) {
+        for (const auto& filename : *files)
+            objNameCounts[getShortObjectName(filename)]++;
+    }
+    auto getObjectName = [&objNameCounts, &getShortObjectName](const std::string& filename, const std::string& intDir) {
+        const std::string objName = getShortObjectName(filename);
+        if (objNameCounts[objName] == 1)
+            return intDir + objName;
+        return intDir + ToHex(FastHash(filename)).substr(0, 8) + "_" + objName;
     };
 
+    std::vector<CompileUnit> units;
     for (const auto& config : project.parsedConfigs) {
         std::string orderOnlyTarget;
         std::string orderDeps;
         std::string depLink;
         std::string depsTargets;
+        // dependency already built before another dependency needs no own order-only edge; libraries are still linked.
+        // entries of dependencies are complete and never change, so they are read without lock once found.
+        auto findPreceding = [this](const std::string& output) -> const std::set<std::string>* {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto                        it = precedingOutputs.find(output);
+            return it == precedingOutputs.cend() ? nullptr : &it->second;
+        };
+        std::set<std::string> impliedDeps;
         for (const VcProjectInfo* dep : project.dependentTargets) {
-            const auto&       depConfig  = *std::find_if(dep->parsedConfigs.cbegin(), dep->parsedConfigs.cend(), [&config](const VcProjectInfo::ParsedConfig& pc) {
-                return pc.name == config.name;
-            });
-            const std::string outputName = this->Escape(depConfig.getOutputNameWithDir());
-            if (dep->type != Type::Unknown)
+            const auto* depConfigPtr = dep->FindParsedConfig(config.name, config.platform);
+            if (!depConfigPtr || dep->type == Type::Unknown)
+                continue;
+            if (const auto* depPreceding = findPreceding(depConfigPtr->getOutputNameWithDir()))
+                impliedDeps.insert(depPreceding->cbegin(), depPreceding->cend());
+        }
+        std::set<std::string> preceding;
+        for (const VcProjectInfo* dep : project.dependentTargets) {
+            const auto* depConfigPtr = dep->FindParsedConfig(config.name, config.platform);
+            if (!depConfigPtr)
+                continue;
+            const auto&       depConfig  = *depConfigPtr;
+            const std::string depOutput  = depConfig.getOutputNameWithDir();
+            const std::string outputName = this->Escape(depOutput);
+            // link edge has libraries as implicit inputs, so they are ordered anyway.
+            const bool isLinked = (type == Type::App || type == Type::Dynamic) && (dep->type == Type::Static || dep->type == Type::Dynamic);
+            if (dep->type != Type::Unknown && !isLinked && !impliedDeps.count(depOutput))
                 depsTargets += " " + outputName;
             if (dep->type == Type::Dynamic)
                 depLink += " " + this->Escape(depConfig.getImportNameWithDir());
             else if (dep->type == Type::Static)
                 depLink += " " + outputName;
+            // with custom commands order-only deps of output are replaced below, only linked libraries stay ordered.
+            if (dep->type != Type::Unknown && (isLinked || config.customCommands.empty())) {
+                if (const auto* depPreceding = findPreceding(depOutput))
+                    preceding.insert(depPreceding->cbegin(), depPreceding->cend());
+                preceding.insert(depOutput);
+            }
         }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            precedingOutputs[config.getOutputNameWithDir()] = std::move(preceding);
+        }
+        // modules of dependencies may be imported, so dependents of projects with modules are scanned too.
+        StringVector depModules;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const VcProjectInfo* dep : project.dependentTargets) {
+                const auto* depConfigPtr = dep->FindParsedConfig(config.name, config.platform);
+                auto        it           = depConfigPtr ? moduleLists.find(depConfigPtr->getOutputNameWithDir()) : moduleLists.cend();
+                if (it == moduleLists.cend())
+                    continue;
+                for (const auto& modulesFile : it->second) {
+                    if (std::find(depModules.cbegin(), depModules.cend(), modulesFile) == depModules.cend())
+                        depModules.push_back(modulesFile);
+                }
+            }
+        }
+        const bool useModules = config.usesModules || !depModules.empty();
         for (const auto& customCmd : config.customCommands) {
             const auto escapedOut = this->Escape(customCmd.output);
-            if (existingRules.find(escapedOut) == existingRules.end()) {
-                const std::string deps = this->Escape(customCmd.deps) + (depsTargets.empty() || type != Type::Utility ? "" : " || " + depsTargets);
-                ss << "\nbuild " << escapedOut << " " << this->Escape(customCmd.additionalOutputs) << ": ";
-                if (customCmd.command.empty())
-                    ss << "phony " << deps << "\n";
-                else
-                    ss << "CUSTOM_COMMAND " << deps << "\n"
-                                                       "  COMMAND = cmd.exe /C \""
-                       << customCmd.command << "\" \n"
-                                               "  DESC = "
-                       << customCmd.message << "\n"
-                                               "  restat = 1\n";
-            }
-            existingRules.insert(escapedOut);
+            // output shared by several targets is built by rule of first target by name, first config wins within target.
+            const std::string deps = this->Escape(customCmd.deps) + (depsTargets.empty() || type != Type::Utility ? "" : " || " + depsTargets);
+            std::string       rule = "\nbuild " + escapedOut + " " + this->Escape(customCmd.additionalOutputs) + ": ";
+            if (customCmd.command.empty())
+                rule += "phony " + deps + "\n";
+            else
+                rule += "CUSTOM_COMMAND " + deps + "\n"
+                        "  COMMAND = cmd.exe /C \"" + customCmd.command + "\" \n"
+                        "  DESC = " + customCmd.message + "\n";
+            customRules.Update(escapedOut, [&project, &escapedOut, &rule](auto& shardRules) {
+                auto ruleIt = shardRules.find(escapedOut);
+                if (ruleIt == shardRules.end() || project.targetName < ruleIt->second.first)
+                    shardRules[escapedOut] = { project.targetName, std::move(rule) };
+            });
             orderDeps += " " + escapedOut;
         }
 
-        if (!orderDeps.empty()) {
-            orderOnlyTarget = "order_only_" + config.name + "_" + config.targetName;
-            ss << "\nbuild " << orderOnlyTarget << ": phony || " << orderDeps << "\n";
+        if (options.fastNoop && config.customCommands.size() == 1) {
+            orderOnlyTarget = orderDeps.substr(1);
+            depsTargets     = orderDeps;
+        } else if (!orderDeps.empty()) {
+            orderOnlyTarget = "order_only_" + config.getId() + "_" + config.targetName;
+            ss += "\nbuild " + orderOnlyTarget + ": phony || " + orderDeps + "\n";
             depsTargets = " " + orderOnlyTarget;
         }
 
         if (type == Type::Utility) {
-            ss << "\nbuild " << this->Escape(config.getOutputNameWithDir()) << ": phony || " << depsTargets << "\n";
+            ss += "\nbuild " + this->Escape(config.getOutputNameWithDir()) + ": phony || " + depsTargets + "\n";
+            // nothing is compiled, but dependents still import modules of projects behind it.
+            if (!depModules.empty()) {
+                std::lock_guard<std::mutex> lock(mutex);
+                moduleLists[config.getOutputNameWithDir()] = depModules;
+            }
             continue;
         }
 
         std::string depObjs = "";
 
-        StringVector cmdDefines;
-        for (const auto& def : config.defines)
-            cmdDefines.push_back("/D" + def);
-        StringVector cmdIncludes;
-        for (const auto& inc : config.includes)
-            cmdIncludes.push_back("/I" + AddQuotes(inc));
-        const std::string preprocessor = "  DEFINES = " + joinVector(cmdDefines) + "\n"
-                                                                                   "  INCLUDES = "
-                                         + joinVector(cmdIncludes) + "\n";
+        const auto& fragments = config.getFragments();
+
+        // with scanned includes, object waits only for generated headers it includes, and for outputs which are neither headers
+        // nor compiled sources: generated source is explicit input of its own object edge already.
+        std::string codegenTarget;
+        if (config.generatedIncludes) {
+            std::unordered_set<std::string> compiledSources(project.clCompileFiles.cbegin(), project.clCompileFiles.cend());
+            compiledSources.insert(project.rcCompileFiles.cbegin(), project.rcCompileFiles.cend());
+            std::string codegenDeps;
+            size_t      codegenCount = 0;
+            for (const auto& customCmd : config.customCommands) {
+                if (!VcProjectInfo::IsHeaderFile(customCmd.output) && !compiledSources.count(customCmd.output)) {
+                    codegenDeps += " " + this->Escape(customCmd.output);
+                    codegenCount++;
+                }
+            }
+            if (options.fastNoop && codegenCount == 1) {
+                codegenTarget = codegenDeps;
+            } else if (!codegenDeps.empty()) {
+                codegenTarget = "codegen_" + config.getId() + "_" + config.targetName;
+                ss += "\nbuild " + codegenTarget + ": phony || " + codegenDeps + "\n";
+            }
+        }
+        auto getObjectOrderDeps = [this, &config, &orderOnlyTarget, &codegenTarget](const std::string& filename) {
+            if (!config.generatedIncludes)
+                return orderOnlyTarget;
+            auto it = config.generatedIncludes->find(filename);
+            return it == config.generatedIncludes->cend() ? codegenTarget : codegenTarget + this->Escape(it->second);
+        };
+
+        // fragments are ninja text; compiler gets them as ninja evaluates them, inline or from response file.
+        auto              noVariables = [](std::string_view) { return std::string(); };
+        const std::string flags = EvaluateNinjaText(fragments.flags, noVariables), defines = EvaluateNinjaText(fragments.defines, noVariables),
+                          includes = EvaluateNinjaText(fragments.includes, noVariables), compilePdb = EvaluateNinjaText(config.intDir + project.targetName + ".pdb", noVariables);
+
+        // long compile command lines are shared by all objects of config through single response file.
+        // It is written by generator, not by build edge (see WriteAuxiliaryFiles); as implicit input of compile edges,
+        // it rebuilds objects when it changes, and missing one fails the build instead of compiling without flags.
+        const bool  useCompileRsp = fragments.defines.size() + fragments.includes.size() + fragments.flags.size() > g_maxCommandLength;
+        const std::string rspName = config.intDir + project.targetName + ".compile.rsp";
+        std::string       compileRspFile;
+        if (useCompileRsp && !project.clCompileFiles.empty()) {
+            compileRspFile = this->Escape(rspName);
+            std::lock_guard<std::mutex> lock(mutex);
+            responseFiles[rspName] = defines + includes + flags;
+        }
+        auto appendCompileFlags = [&useCompileRsp, &compileRspFile, &fragments](std::string& rules) {
+            if (useCompileRsp) {
+                rules += "\n  COMPILE_RSP_FILE = ";
+                rules += compileRspFile;
+            } else {
+                rules += "\n  FLAGS = ";
+                rules += fragments.flags;
+                rules += "\n  DEFINES = ";
+                rules += fragments.defines;
+                rules += "\n  INCLUDES = ";
+                rules += fragments.includes;
+            }
+        };
+        // build log keeps hash of command as ninja evaluates it: edge bindings first, then rule command with them.
+        const std::string compileCommand = CompileCommand(useCompileRsp);
+        auto getCommandHash = [&](const std::string& filename, const std::string& objName) {
+            const std::string source = filename.compare(0, buildRoot.size(), buildRoot) == 0 ? filename.substr(buildRoot.size() + 1) : filename;
+            return NinjaCommandHash(EvaluateNinjaText(compileCommand, [&](std::string_view name) -> std::string {
+                if (name == "in")
+                    return NinjaCommandPath(source);
+                if (name == "out")
+                    return NinjaCommandPath(objName);
+                if (name == "FLAGS")
+                    return flags;
+                if (name == "DEFINES")
+                    return defines;
+                if (name == "INCLUDES")
+                    return includes;
+                if (name == "COMPILE_RSP_FILE")
+                    return rspName;
+                if (name == "TARGET_COMPILE_PDB")
+                    return compilePdb;
+                return std::string();
+            }));
+        };
+        // with modules every object is scanned first; collated scans give objects their module outputs and inputs by dyndep.
+        ModuleCollation collation;
+        std::string     dyndepFile, collateInputs, collateOutputs;
+        if (useModules) {
+            if (options.moduleCollator.empty())
+                throw std::runtime_error("C++ modules of " + project.targetName + " need msbuild2ninja path to collate them");
+            collation.dyndepFile      = config.intDir + project.targetName + ".dd";
+            collation.modulesFile     = config.intDir + project.targetName + ".modules";
+            collation.ifcDir          = config.intDir;
+            collation.depModulesFiles = depModules;
+            dyndepFile                = this->Escape(collation.dyndepFile);
+        }
         for (const auto& filename : project.clCompileFiles) {
             auto fullObjName = getObjectName(filename, config.intDir);
-            depObjs += " " + fullObjName;
+            depObjs += ' ';
+            depObjs += fullObjName;
+            // module objects are not pre-seeded: their commands depend on module maps, which are not collated yet.
+            if (!useModules)
+                units.push_back({ fullObjName, filename, &config.includes, getCommandHash(filename, fullObjName) });
 
-            ss << "build " << fullObjName << ": CXX_COMPILER " << this->Escape(filename) << " || " << orderOnlyTarget << "\n";
-            ss << "  FLAGS = " + joinVector(config.flags) + "\n"
-               << preprocessor;
-            ss << "  TARGET_COMPILE_PDB = " << config.intDir << project.targetName << ".pdb\n";
+            if (useModules) {
+                const std::string scanName  = ModuleCollation::ScanFile(fullObjName);
+                const std::string moduleMap = this->Escape(ModuleCollation::ModuleMapFile(fullObjName));
+                const std::string rspSuffix = useCompileRsp ? "_RSP " : " ";
+                const std::string rspInput  = useCompileRsp ? " | " + compileRspFile : "";
+                const std::string orderDeps = getObjectOrderDeps(filename);
+                collation.objects.push_back(fullObjName);
+                collateInputs += " " + scanName;
+                collateOutputs += " " + moduleMap;
+
+                ss += "build " + scanName + ": CXX_MODULE_SCAN" + rspSuffix + this->Escape(filename) + rspInput + " || " + orderDeps + "\n  OBJ_FILE = " + fullObjName;
+                appendCompileFlags(ss);
+                ss += "\nbuild " + fullObjName + ": CXX_COMPILER_MODULE" + rspSuffix + this->Escape(filename) + (useCompileRsp ? " | " + compileRspFile + " " : " | ") + moduleMap
+                      + " || " + orderDeps + " " + dyndepFile + "\n  dyndep = " + dyndepFile + "\n  MODULE_MAP = " + moduleMap;
+                appendCompileFlags(ss);
+            } else {
+                ss += "build ";
+                ss += fullObjName;
+                if (useCompileRsp) {
+                    ss += ": CXX_COMPILER_RSP ";
+                    ss += this->Escape(filename);
+                    ss += " | ";
+                    ss += compileRspFile;
+                    ss += " || ";
+                    ss += getObjectOrderDeps(filename);
+                } else {
+                    ss += ": CXX_COMPILER ";
+                    ss += this->Escape(filename);
+                    ss += " || ";
+                    ss += getObjectOrderDeps(filename);
+                }
+                appendCompileFlags(ss);
+            }
+            ss += "\n  TARGET_COMPILE_PDB = ";
+            ss += config.intDir;
+            ss += project.targetName;
+            ss += ".pdb\n";
+        }
+        if (useModules) {
+            const std::string collationName = config.intDir + project.targetName + ".collate";
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                responseFiles[collationName] = collation.Serialize();
+                moduleLists[config.getOutputNameWithDir()] = { collation.modulesFile };
+            }
+            ss += "build " + dyndepFile + " | " + this->Escape(collation.modulesFile) + collateOutputs + ": CXX_MODULE_COLLATE" + collateInputs
+                  + " | " + this->Escape(collationName) + this->Escape(depModules) + "\n  COLLATION = " + this->Escape(collationName) + "\n";
         }
         for (const auto& filename : project.rcCompileFiles) {
             auto fullObjName = getObjectName(filename, config.intDir);
-            depObjs += " " + fullObjName;
+            depObjs += ' ';
+            depObjs += fullObjName;
 
-            ss << "build " << fullObjName << ": RC_COMPILER " << this->Escape(filename) << " || " << orderOnlyTarget << "\n";
-            ss << preprocessor;
+            ss += "build ";
+            ss += fullObjName;
+            ss += ": RC_COMPILER ";
+            ss += this->Escape(filename);
+            ss += " || ";
+            ss += orderOnlyTarget;
+            ss += "\n  DEFINES = ";
+            ss += fragments.defines;
+            ss += "\n  INCLUDES = ";
+            ss += fragments.includes;
+            ss += '\n';
         }
 
-        std::string linkLibraries = joinVector(config.link);
-        std::string linkFlags     = joinVector(config.linkFlags);
+        const std::string& linkLibraries = fragments.linkLibraries;
+        const std::string& linkFlags     = fragments.linkFlags;
 
         if (type == Type::App || type == Type::Dynamic) {
-            const bool        useRsp     = linkFlags.size() + linkLibraries.size() + depLink.size() + depObjs.size() > 2000; // do not support NT 4
+            const bool        useRsp     = linkFlags.size() + linkLibraries.size() + depLink.size() + depObjs.size() > g_maxCommandLength;
             const std::string ruleSuffix = useRsp ? "_RSP" : "";
+            // incremental link database is placed next to output file.
+            const std::string ilkOutput = options.fastLink ? " | " + this->Escape(config.outDir + config.targetName + ".ilk") : "";
             if (type == Type::App)
-                ss << "\nbuild " << this->Escape(config.getOutputNameWithDir()) << ": CXX_EXECUTABLE_LINKER" << ruleSuffix << " " << depObjs << " | " << depLink << " || " << depsTargets << "\n";
+                ss += "\nbuild " + this->Escape(config.getOutputNameWithDir()) + ilkOutput + ": CXX_EXECUTABLE_LINKER" + ruleSuffix + " " + depObjs + " | " + depLink + " || " + depsTargets + "\n";
             else
-                ss << "\nbuild " << this->Escape(config.getImportNameWithDir()) << " " << this->Escape(config.getOutputNameWithDir()) << ": CXX_SHARED_LIBRARY_LINKER" << ruleSuffix << " " << depObjs << " | " << depLink << " || " << depsTargets << "\n";
+                ss += "\nbuild " + this->Escape(config.getImportNameWithDir()) + " " + this->Escape(config.getOutputNameWithDir()) + ilkOutput + ": CXX_SHARED_LIBRARY_LINKER" + ruleSuffix + " " + depObjs + " | " + depLink + " || " + depsTargets + "\n";
 
             // clang-format off
-            ss << "  FLAGS = \n"
-                "  LINK_FLAGS = " << linkFlags << "\n"
-                "  LINK_LIBRARIES = " << linkLibraries << " " << depLink << "\n"
-                "  OBJECT_DIR = " << project.targetName << ".dir\\" << config.name << "\n"
+            ss += "  FLAGS = \n"
+                "  LINK_FLAGS = " + linkFlags + "\n"
+                "  LINK_LIBRARIES = " + linkLibraries + " " + depLink + "\n"
+                "  OBJECT_DIR = " + project.targetName + ".dir\\" + config.getId() + "\n"
                 "  POST_BUILD = cd .\n"
                 "  PRE_LINK = cd .\n"
-                "  TARGET_COMPILE_PDB = " << project.targetName << ".dir\\" << config.name << "\\ \n"
-                "  TARGET_FILE = " << this->Escape(config.getOutputNameWithDir()) << "\n"
-                "  TARGET_IMPLIB = " << this->Escape(config.getImportNameWithDir()) << "\n"
-                "  TARGET_PDB = " << this->Escape(config.outDir + config.targetName) << ".pdb\n"
+                "  TARGET_COMPILE_PDB = " + project.targetName + ".dir\\" + config.getId() + "\\ \n"
+                "  TARGET_FILE = " + this->Escape(config.getOutputNameWithDir()) + "\n"
+                "  TARGET_IMPLIB = " + this->Escape(config.getImportNameWithDir()) + "\n"
+                "  TARGET_PDB = " + this->Escape(config.outDir + config.targetName) + ".pdb\n"
                   ;
             // clang-format on
             if (useRsp)
-                ss << "  RSP_FILE = " << config.name << "\\" << config.targetName << ".rsp\n";
+                ss += "  RSP_FILE = " + config.name + "\\" + config.targetName + config.platformSuffix + ".rsp\n";
         } else if (type == Type::Static) {
             // clang-format off
-            ss << "\nbuild " << this->Escape(config.getOutputNameWithDir()) << ": CXX_STATIC_LIBRARY_LINKER " << depObjs << " || " << depsTargets << "\n"
+            ss += "\nbuild " + this->Escape(config.getOutputNameWithDir()) + ": CXX_STATIC_LIBRARY_LINKER " + depObjs + " || " + depsTargets + "\n"
                "  LANGUAGE_COMPILE_FLAGS =\n"
-               "  LINK_FLAGS = " << linkFlags << "\n"
-               "  OBJECT_DIR = " << project.targetName << ".dir\\" << config.name << "\n"
+               "  LINK_FLAGS = " + linkFlags + "\n"
+               "  OBJECT_DIR = " + project.targetName + ".dir\\" + config.getId() + "\n"
                "  POST_BUILD = cd .\n"
                "  PRE_LINK = cd .\n"
-               "  TARGET_COMPILE_PDB = " << project.targetName << ".dir\\" << config.name << "\\" << config.targetName << ".pdb\n"
-               "  TARGET_FILE = " << this->Escape(config.getOutputNameWithDir()) << "\n"
-               "  TARGET_PDB = " << config.name << "\\" << config.targetName << ".pdb\n"
+               "  TARGET_COMPILE_PDB = " + project.targetName + ".dir\\" + config.getId() + "\\" + config.targetName + ".pdb\n"
+               "  TARGET_FILE = " + this->Escape(config.getOutputNameWithDir()) + "\n"
+               "  TARGET_PDB = " + config.name + "\\" + config.targetName + config.platformSuffix + ".pdb\n"
                   ;
             // clang-format on
         }
-        ss << "\nbuild " << this->Escape(config.getOutputAlias()) << ": phony || " << this->Escape(config.getOutputNameWithDir()) << "\n";
+        if (!options.fastNoop)
+            ss += "\nbuild " + this->Escape(config.getOutputAlias()) + ": phony || " + this->Escape(config.getOutputNameWithDir()) + "\n";
     }
 
-    targetRules << ss.str();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (options.spillRules) {
+        spilledRules[project.targetName] = { static_cast<uint64_t>(spillFile.tellp()), ss.size() };
+        if (!spillFile.write(ss.data(), ss.size()).flush())
+            throw std::runtime_error("Failed to write file:" + g_spillFileName);
+    } else {
+        targetRules[project.targetName] += ss;
+    }
+    compileUnits.insert(compileUnits.end(), units.cbegin(), units.cend());
 }
@@ -1,30 +1,78 @@
 #pragma once
 
 #include "CommonTypes.h"
+#include "ShardedMap.h"
 
 #include <map>
+#include <mutex>
+#include <fstream>
 #include <sstream>
 #include <set>
 
 struct VcProjectInfo;
+class ThreadPool;
+class IncludeScanner;
 
 class NinjaWriter {
-    std::map<std::string, std::string> idents;
-    std::ostringstream                 identsDecl;
-    std::ostringstream                 targetRules;
-    std::set<std::string>              existingRules;
-    int                                maxIdent = 0;
-    const std::string                  buildRoot, cmakeExe;
+public:
+    struct CompileUnit {
+        std::string         objectPath;
+        std::string         sourcePath;
+        const StringVector* includeDirs;
+        uint64_t            commandHash; // of compile command, as ninja records it in build log.
+    };
+
+    /// Output tuning, mostly for distributed compilation.
+    struct Options {
+        std::string compilerLauncher; // prefix of compiler command; empty means plain local build without pools.
+        bool        embedDebugInfo = false;
+        size_t      localJobs      = 1;     // depth of pool for link and custom steps, which have to run locally.
+        size_t      remoteJobs     = 0;     // depth of pool for compile steps, 0 leaves them to ninja -j.
+        bool        fastNoop       = false; // no alias and single-input phony nodes, each of them is a stat on no-op build.
+        bool        fastLink       = false; // links are incremental, so .ilk files are their outputs too.
+        bool        spillRules     = false; // target rules go to temporary file once generated, so memory does not grow with output.
+        std::string moduleCollator;         // command running msbuild2ninja --collate-modules; C++ modules are not supported if empty.
+    };
+
+private:
+    // everything is keyed by content or target name, so output does not depend on order projects are processed.
+    // GenerateNinjaRules may run concurrently: idents and custom rules are claimed through sharded tables, rest is under mutex.
+    ShardedMap<std::map<std::string, std::string, StringViewLess>>         idents;
+    std::mutex                                                             identNamesMutex;
+    std::set<std::string, StringViewLess>                                  identNames;
+    ShardedMap<std::map<std::string, std::pair<std::string, std::string>>> customRules; // output -> owner target, rule.
+    std::mutex                                                             mutex;
+    std::map<std::string, std::string>                                     targetRules;
+    std::ofstream                                                          spillFile;
+    std::map<std::string, std::pair<uint64_t, uint64_t>>                   spilledRules; // target -> offset and size in spillFile.
+    std::map<std::string, std::set<std::string>>                           precedingOutputs; // output -> dependency outputs surely built before it.
+    std::map<std::string, std::string>                                     responseFiles;
+    std::map<std::string, StringVector>                                    moduleLists; // output -> modules files, for configs using C++ modules or depending on them.
+    std::vector<CompileUnit>                                               compileUnits;
+    const std::string                                                      buildRoot, cmakeExe;
+    const Options                                                          options;
+
+    /// Command of compile rule, with launcher and ninja variables.
+    std::string CompileCommand(bool useRsp) const;
 
 public:
-    NinjaWriter(const std::string& buildRoot_, const std::string& cmakeExe_)
-        : buildRoot(buildRoot_)
-        , cmakeExe(cmakeExe_)
-    {}
+    NinjaWriter(const std::string& buildRoot_, const std::string& cmakeExe_, const Options& options_);
+    ~NinjaWriter();
     std::string Escape(std::string value);
     std::string Escape(const StringVector& values);
 
+    /// Writes build.ninja content into sink. It refers to response and module collation files, see WriteAuxiliaryFiles.
+    void Write(std::ostream& sink) const;
+    /// Writes response and module collation files into build root; files with same content are not touched.
+    void WriteAuxiliaryFiles() const;
+    /// Writes build.ninja and auxiliary files into build root.
     void WriteFile(bool verbose) const;
 
+    /// Writes .ninja_deps with scanned includes of already built objects, and .ninja_log with their commands, so first build
+    /// does not rebuild them for missing deps or log entries. Needs ninja 1.10+ deps log and v5 build log formats,
+    /// ninja versions reading neither just start new logs; does nothing if any of logs already exists.
+    void PreseedDepsLog(ThreadPool& pool, IncludeScanner& scanner) const;
+
+    /// Thread-safe for projects not depending on each other; dependencies should be generated before.
     void GenerateNinjaRules(const VcProjectInfo& project);
 };
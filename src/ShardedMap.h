@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+
+#pragma once
+
+#include "CommonTypes.h"
+
+#include <algorithm>
+#include <array>
+#include <mutex>
+
+/// Map split into shards by key hash, each with own lock, so threads inserting different keys rarely wait for each other.
+/// Keys are strings; merged content is sorted by key, so it does not depend on order of inserts.
+template<class Map, size_t ShardCount = 16>
+class ShardedMap {
+    struct Shard {
+        std::mutex mutex;
+        Map        map;
+    };
+    std::array<Shard, ShardCount> shards;
+
+public:
+    /// Calls func with map of key shard locked; func should touch only this key.
+    template<class Func>
+    auto Update(std::string_view key, Func&& func)
+    {
+        Shard&                      shard = shards[FastHash(key) % ShardCount];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return func(shard.map);
+    }
+
+    /// All entries of all shards, sorted by key. Must not run concurrently with Update.
+    std::vector<const typename Map::value_type*> GetSorted() const
+    {
+        std::vector<const typename Map::value_type*> result;
+        for (const Shard& shard : shards) {
+            for (const auto& entry : shard.map)
+                result.push_back(&entry);
+        }
+        std::sort(result.begin(), result.end(), [](const auto* l, const auto* r) { return std::string_view(l->first) < std::string_view(r->first); });
+        return result;
+    }
+};
@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+#include "Solution.h"
+#include "FileUtils.h"
+#include "ThreadPool.h"
+#include "IncludeScanner.h"
+#include "FilePrefetcher.h"
+#include "InputManifest.h"
+
+#include <algorithm>
+#include <future>
+#include <map>
+#include <thread>
+#include <regex>
+#include <ostream>
+
+namespace fs = std::filesystem;
+
+namespace {
+const std::string g_manifestExtension = ".manifest";
+
+/// Everything affecting conversion of project; model of converted project is reused only with same settings.
+std::string getProjectSettingsKey(const CommandLine& settings, const StringVector& customDeps)
+{
+    return joinVector(settings.configs) + "|" + joinVector(settings.platforms) + "|" + settings.ninjaExe + "|" + joinVector(customDeps) + (settings.embedDebugInfo ? "|Z7" : "") + (settings.fastNoop ? "|fastNoop" : "") + (settings.fastLink ? "|fastLink" : "");
+}
+
+/// Everything affecting conversion of solution: settings of its projects, and options used by build.ninja only.
+std::string getSolutionSettingsKey(const CommandLine& settings)
+{
+    std::string key = getProjectSettingsKey(settings, {}) + "|" + settings.cmakeExe + "|" + settings.compilerLauncher + "|" + settings.moduleCollator + "|" + std::to_string(settings.localJobs) + "|" + std::to_string(settings.remoteJobs) + (settings.scanIncludes ? "|scanIncludes" : "") + (settings.preciseCodegen ? "|preciseCodegen" : "");
+    for (const auto& deps : settings.additionalDeps)
+        key += "|" + deps.first + "=" + joinVector(deps.second, ',');
+    return key;
+}
+
+void parseSln(const std::string& slnBase, const std::string& slnName, VcProjectList& vcprojs, const bool dryRun)
+{
+    std::string filestr;
+    if (!FileInfo(slnBase + "/" + slnName).ReadFile(filestr))
+        throw std::runtime_error("Failed to read .sln file");
+
+    std::smatch res;
+
+    std::regex                  exp(R"rx(Project\("\{[0-9A-F-]+\}"\) = "(\w+)", "(\w+\.vcxproj)", "\{([0-9A-F-]+)\}"\s*ProjectSection\(ProjectDependencies\) = postProject)rx", std::regex_constants::ECMAScript | std::regex_constants::optimize);
+    std::regex                  exp2(R"rx(\{([0-9A-F-]+)\} = )rx", std::regex_constants::ECMAScript | std::regex_constants::optimize);
+    std::string::const_iterator searchStart(filestr.cbegin());
+    std::string                 ALL_BUILD_GUID;
+    while (std::regex_search(searchStart, filestr.cend(), res, exp)) {
+        VcProjectInfo info;
+        info.baseDir    = slnBase;
+        info.targetName = res[1].str();
+        info.fileName   = res[2].str();
+        info.GUID       = res[3].str();
+
+        if (info.targetName == "ALL_BUILD")
+            ALL_BUILD_GUID = info.GUID;
+
+        size_t      posStart = searchStart - filestr.cbegin() + res.position() + res.length();
+        size_t      posEnd   = filestr.find("EndProjectSection", posStart);
+        std::smatch res2;
+
+        std::string::const_iterator searchStart2(filestr.cbegin() + posStart);
+        while (std::regex_search(searchStart2, filestr.cbegin() + posEnd, res2, exp2)) {
+            info.dependentGuids.push_back(res2[1].str());
+            searchStart2 += res2.position() + res2.length();
+        }
+        vcprojs.push_back(info);
+        searchStart += res.position() + res.length();
+    }
+
+    // converted solution has dependencies stripped, so they are kept aside for later runs, with hash of solution they belong to:
+    // solution regenerated without dependencies must not get old ones back.
+    FileInfo          depsFile(slnBase + "/" + slnName + ".deps");
+    const std::string slnHashPrefix = "sln ";
+    const bool        hasDeps       = std::any_of(vcprojs.cbegin(), vcprojs.cend(), [](const VcProjectInfo& info) { return !info.dependentGuids.empty(); });
+    if (!hasDeps) {
+        std::string  depsData;
+        depsFile.ReadFile(depsData);
+        StringVector lines = strToList(depsData, '\n');
+        // files written before hash was recorded are trusted, as their solutions can't be restored anyway.
+        if (!lines.empty() && lines[0].compare(0, slnHashPrefix.size(), slnHashPrefix) == 0) {
+            if (lines[0] != slnHashPrefix + std::to_string(FastHash(filestr)))
+                lines.clear();
+            else
+                lines.erase(lines.begin());
+        }
+        for (const auto& line : lines) {
+            StringVector guids = strToList(line, ' ');
+            auto         it    = std::find_if(vcprojs.begin(), vcprojs.end(), [&guids](const VcProjectInfo& info) { return info.GUID == guids[0]; });
+            if (it != vcprojs.end())
+                it->dependentGuids.assign(guids.cbegin() + 1, guids.cend());
+        }
+    }
+    std::regex post("postProject[\r\n\t {}=0-9A-F-]+EndProjectSection", std::regex_constants::ECMAScript | std::regex_constants::optimize);
+    filestr = std::regex_replace(filestr, post, "postProject\n\tEndProjectSection");
+    if (hasDeps) {
+        std::string depsData = slnHashPrefix + std::to_string(FastHash(filestr)) + "\n";
+        for (const auto& info : vcprojs)
+            depsData += info.GUID + joinVector(info.dependentGuids) + "\n";
+        if (!dryRun && !depsFile.WriteFile(depsData))
+            throw std::runtime_error("Failed to write file:" + depsFile.GetPath());
+    }
+    if (!dryRun && !FileInfo(slnBase + "/" + slnName).WriteFile(filestr))
+        throw std::runtime_error("Failed to write file:" + slnName);
+}
+}
+
+Solution::Solution(const CommandLine& settings_, ThreadPool& pool_, ThreadPool& ioPool_, IncludeScanner& scanner_)
+    : settings(settings_)
+    , pool(pool_)
+    , ioPool(ioPool_)
+    , scanner(scanner_)
+{}
+
+Solution::~Solution() = default;
+
+bool Solution::IsUpToDate(const CommandLine& settings)
+{
+    const std::string manifestPath = settings.rootDir + "/" + settings.slnFile + g_manifestExtension;
+    if (FileInfo(manifestPath).Exists())
+        return !InputManifest::IsStale(manifestPath, getSolutionSettingsKey(settings));
+
+    // converted before manifest was introduced; projects are marked as converted, so only solution is checked.
+    std::error_code ec;
+    const auto      slnTime   = fs::last_write_time(fs::path(settings.rootDir) / settings.slnFile, ec);
+    const auto      checkTime = fs::last_write_time(fs::path(settings.rootDir) / (settings.slnFile + ".timestamp"), ec);
+    return slnTime <= checkTime;
+}
+
+void Solution::Load()
+{
+    // scanner may outlive previous conversion, headers could be edited since.
+    scanner.Revalidate();
+    projects.clear();
+    parseSln(settings.rootDir, settings.slnFile, projects, settings.dryRun);
+
+    for (auto& p : projects)
+        p.CalculateDependentTargets(projects);
+    levels = CalculateDependencyLevels(projects);
+    projectTimes.assign(projects.size(), {});
+
+    std::vector<VcProjectInfo*> all;
+    for (auto& p : projects)
+        all.push_back(&p);
+    Convert(all);
+}
+
+StringVector Solution::ReloadChanged()
+{
+    StringVector      names;
+    std::vector<bool> isChanged(projects.size());
+    for (size_t i = 0; i < projects.size(); ++i) {
+        std::error_code ec;
+        isChanged[i] = fs::last_write_time(fs::path(projects[i].baseDir) / projects[i].fileName, ec) != projectTimes[i];
+        if (isChanged[i])
+            names.push_back(projects[i].targetName);
+    }
+    if (names.empty())
+        return names;
+    scanner.Revalidate();
+
+    std::vector<VcProjectInfo*> changed;
+    for (size_t i = 0; i < projects.size(); ++i) {
+        // released projects lack data for rules, so all of them are converted again.
+        if (!isChanged[i] && !settings.streaming)
+            continue;
+        // only solution data survives, everything else comes from project file again.
+        VcProjectInfo& p = projects[i];
+        VcProjectInfo  fresh;
+        fresh.baseDir          = p.baseDir;
+        fresh.targetName       = p.targetName;
+        fresh.fileName         = p.fileName;
+        fresh.GUID             = p.GUID;
+        fresh.dependentGuids   = p.dependentGuids;
+        fresh.dependentTargets = p.dependentTargets;
+        p                      = std::move(fresh);
+        changed.push_back(&p);
+    }
+    Convert(changed);
+    return names;
+}
+
+const VcProjectInfo* Solution::FindProject(const std::string& targetName) const
+{
+    auto it = std::find_if(projects.cbegin(), projects.cend(), [&targetName](const VcProjectInfo& p) { return p.targetName == targetName; });
+    return it == projects.cend() ? nullptr : &*it;
+}
+
+void Solution::WriteNinja(std::ostream& sink) const
+{
+    ninjaWriter->Write(sink);
+}
+
+void Solution::WriteAuxiliaryFiles() const
+{
+    ninjaWriter->WriteAuxiliaryFiles();
+}
+
+void Solution::WriteFiles() const
+{
+    ninjaWriter->WriteFile(settings.verbose);
+    if (settings.scanIncludes)
+        ninjaWriter->PreseedDepsLog(pool, scanner);
+    if (!settings.dryRun) {
+        FileInfo(settings.rootDir + "/" + settings.slnFile + ".timestamp").WriteFile("1");
+        WriteManifest();
+    }
+    for (const auto& config : settings.configs)
+        FileInfo(settings.rootDir + "/" + config + "/").Mkdirs();
+}
+
+void Solution::WriteManifest() const
+{
+    // everything is read again, as converted files differ from what was parsed.
+    // Models and solution dependencies are recorded too: next conversion reads them instead of parsing.
+    StringVector      inputFiles{ settings.rootDir + "/" + settings.slnFile };
+    const std::string depsPath = settings.rootDir + "/" + settings.slnFile + ".deps";
+    if (FileInfo(depsPath).Exists())
+        inputFiles.push_back(depsPath);
+    for (const auto& p : projects) {
+        for (auto& path : p.GetInputFiles())
+            inputFiles.push_back(std::move(path));
+    }
+    FilePrefetcher files(ioPool);
+    files.Prefetch(inputFiles);
+
+    InputManifest manifest;
+    for (const auto& path : inputFiles) {
+        std::string data;
+        if (!files.Read(path, data))
+            throw std::runtime_error("Failed to read file:" + path);
+        manifest.Add(path, data);
+    }
+    const std::string manifestPath = settings.rootDir + "/" + settings.slnFile + g_manifestExtension;
+    if (!manifest.Write(manifestPath, getSolutionSettingsKey(settings)))
+        throw std::runtime_error("Failed to write file:" + manifestPath);
+}
+
+void Solution::Convert(const std::vector<VcProjectInfo*>& changed)
+{
+    NinjaWriter::Options options;
+    options.compilerLauncher = settings.compilerLauncher;
+    options.embedDebugInfo   = settings.embedDebugInfo;
+    options.localJobs        = settings.localJobs ? settings.localJobs : std::max(1u, std::thread::hardware_concurrency());
+    options.remoteJobs       = settings.remoteJobs;
+    options.fastNoop         = settings.fastNoop;
+    options.fastLink         = settings.fastLink;
+    options.spillRules       = settings.streaming;
+    options.moduleCollator   = settings.moduleCollator;
+    // rules depend on whole solution (idents, implied deps), so they are generated again for every project.
+    ninjaWriter.reset(); // previous one would remove temporary files of new one.
+    ninjaWriter = std::make_unique<NinjaWriter>(settings.rootDir, settings.cmakeExe, options);
+
+    std::vector<VcProjectInfo*> ordered;
+    for (const auto& level : levels) {
+        for (VcProjectInfo* p : level) {
+            if (std::find(changed.cbegin(), changed.cend(), p) != changed.cend())
+                ordered.push_back(p);
+        }
+    }
+    // files of next batch are requested before its parsing starts, in order they are parsed.
+    // Without streaming everything is one batch; with it, only few projects are ahead of rule generation, so few are in memory.
+    FilePrefetcher                                    files(ioPool);
+    std::map<const VcProjectInfo*, std::future<void>> conversions;
+    size_t                                            enqueued = 0;
+
+    auto enqueueConversions = [this, &ordered, &files, &conversions, &enqueued](size_t end) {
+        end = std::min(end, ordered.size());
+        StringVector inputFiles;
+        for (size_t i = enqueued; i < end; ++i) {
+            for (auto& path : ordered[i]->GetInputFiles())
+                inputFiles.push_back(std::move(path));
+        }
+        files.Prefetch(inputFiles);
+        for (; enqueued < end; ++enqueued) {
+            VcProjectInfo* p     = ordered[enqueued];
+            const size_t   index = p - projects.data();
+            conversions[p]       = pool.Enqueue([this, p, index, &files] {
+                static const StringVector noDeps;
+                auto                      depsIt     = settings.additionalDeps.find(p->targetName);
+                const StringVector&       customDeps = depsIt == settings.additionalDeps.cend() ? noDeps : depsIt->second;
+                const std::string         settingsKey = getProjectSettingsKey(settings, customDeps);
+                p->ReadVcProj(files);
+                if (!p->LoadConvertedModel(settingsKey, files)) {
+                    p->ParseConfigs(settings.configs, settings.platforms);
+                    p->TransformConfigs(settings.configs, settings.platforms, settings.rootDir, settings.embedDebugInfo, settings.fastLink);
+                    p->ConvertToMakefile(settings.ninjaExe, customDeps, settings.fastNoop);
+                    if (!settings.dryRun)
+                        p->WriteVcProj(settingsKey);
+                }
+                if (settings.preciseCodegen)
+                    p->ScanGeneratedIncludes(scanner);
+                std::error_code ec;
+                projectTimes[index] = fs::last_write_time(fs::path(p->baseDir) / p->fileName, ec);
+            });
+        }
+    };
+    const size_t window = settings.streaming ? pool.GetThreadCount() : ordered.size();
+    enqueueConversions(window);
+
+    // projects of one level do not depend on each other, so their rules are generated concurrently, level after level.
+    std::vector<std::future<void>> generations;
+    size_t                         levelEnd = 0;
+    try {
+        for (const auto& level : levels) {
+            for (VcProjectInfo* p : level) {
+                if (levelEnd < ordered.size() && ordered[levelEnd] == p)
+                    levelEnd++;
+            }
+            enqueueConversions(levelEnd + window);
+            for (VcProjectInfo* p : level) {
+                auto it = conversions.find(p);
+                if (it != conversions.end())
+                    it->second.get();
+            }
+            generations.clear();
+            for (VcProjectInfo* p : level) {
+                generations.push_back(pool.Enqueue([this, p] {
+                    ninjaWriter->GenerateNinjaRules(*p);
+                    if (settings.streaming)
+                        p->ReleaseData();
+                }));
+            }
+            for (auto& generation : generations)
+                generation.get();
+        }
+    }
+    catch (...) {
+        // pending tasks refer to this solution, which may be gone after rethrow.
+        for (auto& conversion : conversions) {
+            if (conversion.second.valid())
+                conversion.second.wait();
+        }
+        for (auto& generation : generations) {
+            if (generation.valid())
+                generation.wait();
+        }
+        throw;
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+
+#pragma once
+
+#include "CommandLine.h"
+#include "VcProjectInfo.h"
+
+#include <filesystem>
+#include <iosfwd>
+#include <memory>
+
+class ThreadPool;
+class IncludeScanner;
+
+/// Converted solution, kept in memory between conversions: long-lived host loads it once,
+/// then converts again only changed projects. Command line tool is a thin wrapper over it.
+class Solution {
+    const CommandLine                            settings;
+    ThreadPool&                                  pool;
+    ThreadPool&                                  ioPool; // for file reads, which mostly wait for disk or network.
+    IncludeScanner&                              scanner;
+    VcProjectList                                projects;
+    std::vector<std::vector<VcProjectInfo*>>     levels;
+    std::vector<std::filesystem::file_time_type> projectTimes; // of project files after conversion, by index in projects.
+    std::unique_ptr<NinjaWriter>                 ninjaWriter;
+
+public:
+    /// settings.rootDir and settings.slnFile should be set, see CommandLine::SetBuildDir.
+    /// Pools and scanner may be shared by solutions converted concurrently.
+    Solution(const CommandLine& settings_, ThreadPool& pool_, ThreadPool& ioPool_, IncludeScanner& scanner_);
+    ~Solution();
+
+    /// True if solution and its projects were not changed since last conversion. Nothing is parsed,
+    /// only files recorded by last conversion are checked, so it is cheap enough to call before every build.
+    static bool IsUpToDate(const CommandLine& settings);
+    bool        IsUpToDate() const { return IsUpToDate(settings); }
+
+    /// Parses solution and converts all its projects. Throws on error.
+    void Load();
+
+    /// Converts again projects which files were changed after previous conversion, e.g. regenerated by CMake.
+    /// Returns their target names. With settings.streaming all projects are converted again, if any changed.
+    StringVector ReloadChanged();
+
+    /// With settings.streaming, only names and types are left in projects after conversion, see VcProjectInfo::ReleaseData.
+    const VcProjectList& GetProjects() const { return projects; }
+    const VcProjectInfo* FindProject(const std::string& targetName) const;
+
+    /// Writes build.ninja content into sink. Build needs response and module collation files it refers to,
+    /// so WriteAuxiliaryFiles should be called too, unless WriteFiles is.
+    void WriteNinja(std::ostream& sink) const;
+    /// Writes files referred from build.ninja content into build directory.
+    void WriteAuxiliaryFiles() const;
+
+    /// Writes build.ninja with response files, deps log and timestamp into build directory, as command line tool does.
+    void WriteFiles() const;
+
+private:
+    void WriteManifest() const;
+    void Convert(const std::vector<VcProjectInfo*>& changed);
+};
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+
+#include "StringKernels.h"
+
+#include <cctype>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STRING_KERNELS_SSE2
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+const size_t g_maxVectorChars = 4;
+
+#ifdef STRING_KERNELS_SSE2
+inline unsigned LowestBit(unsigned mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+/// Bytes of block equal to any of chars (at most g_maxVectorChars of them) are set to 0xFF.
+struct Matcher16 {
+    __m128i needles[g_maxVectorChars];
+    size_t  count;
+
+    explicit Matcher16(std::string_view chars)
+        : count(chars.size())
+    {
+        for (size_t i = 0; i < count; ++i)
+            needles[i] = _mm_set1_epi8(chars[i]);
+    }
+    __m128i Match(__m128i block) const
+    {
+        __m128i result = _mm_cmpeq_epi8(block, needles[0]);
+        for (size_t i = 1; i < count; ++i)
+            result = _mm_or_si128(result, _mm_cmpeq_epi8(block, needles[i]));
+        return result;
+    }
+};
+#endif
+
+#ifdef __AVX2__
+struct Matcher32 {
+    __m256i needles[g_maxVectorChars];
+    size_t  count;
+
+    explicit Matcher32(std::string_view chars)
+        : count(chars.size())
+    {
+        for (size_t i = 0; i < count; ++i)
+            needles[i] = _mm256_set1_epi8(chars[i]);
+    }
+    __m256i Match(__m256i block) const
+    {
+        __m256i result = _mm256_cmpeq_epi8(block, needles[0]);
+        for (size_t i = 1; i < count; ++i)
+            result = _mm256_or_si256(result, _mm256_cmpeq_epi8(block, needles[i]));
+        return result;
+    }
+};
+#endif
+
+inline bool IsSpace(char c)
+{
+    return std::isspace(static_cast<unsigned char>(c)) != 0;
+}
+
+}
+
+size_t FindFirstOf(std::string_view value, std::string_view chars, size_t pos)
+{
+    if (chars.empty())
+        return std::string_view::npos;
+    if (chars.size() == 1)
+        return value.find(chars[0], pos); // memchr is vectorized already.
+    if (chars.size() > g_maxVectorChars)
+        return value.find_first_of(chars, pos);
+
+#ifdef __AVX2__
+    const Matcher32 matcher32(chars);
+    for (; pos + 32 <= value.size(); pos += 32) {
+        const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(matcher32.Match(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(value.data() + pos)))));
+        if (mask)
+            return pos + LowestBit(mask);
+    }
+#endif
+#ifdef STRING_KERNELS_SSE2
+    const Matcher16 matcher(chars);
+    for (; pos + 16 <= value.size(); pos += 16) {
+        const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(matcher.Match(_mm_loadu_si128(reinterpret_cast<const __m128i*>(value.data() + pos)))));
+        if (mask)
+            return pos + LowestBit(mask);
+    }
+#endif
+    return value.find_first_of(chars, pos);
+}
+
+void ReplaceAll(std::string& value, std::string_view chars, char replacement)
+{
+    if (chars.empty() || value.empty())
+        return;
+
+    char*        data = &value[0];
+    const size_t size = value.size();
+    size_t       pos  = 0;
+    if (chars.size() <= g_maxVectorChars) {
+#ifdef __AVX2__
+        const Matcher32 matcher32(chars);
+        const __m256i   replacement32 = _mm256_set1_epi8(replacement);
+        for (; pos + 32 <= size; pos += 32) {
+            __m256i*      ptr   = reinterpret_cast<__m256i*>(data + pos);
+            const __m256i block = _mm256_loadu_si256(ptr);
+            const __m256i match = matcher32.Match(block);
+            if (_mm256_movemask_epi8(match))
+                _mm256_storeu_si256(ptr, _mm256_blendv_epi8(block, replacement32, match));
+        }
+#endif
+#ifdef STRING_KERNELS_SSE2
+        const Matcher16 matcher(chars);
+        const __m128i   replacement16 = _mm_set1_epi8(replacement);
+        for (; pos + 16 <= size; pos += 16) {
+            __m128i*      ptr   = reinterpret_cast<__m128i*>(data + pos);
+            const __m128i block = _mm_loadu_si128(ptr);
+            const __m128i match = matcher.Match(block);
+            if (_mm_movemask_epi8(match))
+                _mm_storeu_si128(ptr, _mm_or_si128(_mm_and_si128(match, replacement16), _mm_andnot_si128(match, block)));
+        }
+#endif
+    }
+    for (; pos < size; ++pos) {
+        if (chars.find(data[pos]) != std::string_view::npos)
+            data[pos] = replacement;
+    }
+}
+
+std::string EscapeAll(std::string_view value, std::string_view chars, char escape)
+{
+    size_t found = FindFirstOf(value, chars);
+    if (found == std::string_view::npos)
+        return std::string(value);
+
+    std::string result;
+    result.reserve(value.size() + 8);
+    size_t pos = 0;
+    for (; found != std::string_view::npos; found = FindFirstOf(value, chars, found + 1)) {
+        result.append(value.data() + pos, found - pos);
+        result += escape;
+        pos = found;
+    }
+    result.append(value.data() + pos, value.size() - pos);
+    return result;
+}
+
+StringVector SplitTrimmed(std::string_view value, char sep)
+{
+    StringVector result;
+    size_t       pos = 0;
+    while (pos < value.size()) {
+        size_t end = value.find(sep, pos);
+        if (end == std::string_view::npos)
+            end = value.size();
+        size_t first = pos, last = end;
+        while (first < last && IsSpace(value[first]))
+            ++first;
+        while (last > first && IsSpace(value[last - 1]))
+            --last;
+        if (first < last)
+            result.emplace_back(value.data() + first, last - first);
+        pos = end + 1;
+    }
+    return result;
+}
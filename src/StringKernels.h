@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+
+#pragma once
+
+#include "CommonTypes.h"
+
+// Vectorized (SSE2, AVX2 if compiled with it) loops over characters, with scalar fallback on other targets.
+// Character sets are small: up to 4 characters are vectorized, longer sets are handled by scalar code.
+
+/// Position of first character from chars at or after pos, or npos.
+size_t FindFirstOf(std::string_view value, std::string_view chars, size_t pos = 0);
+
+/// Replaces every character from chars with replacement, in place.
+void ReplaceAll(std::string& value, std::string_view chars, char replacement);
+
+/// Copy of value with escape inserted before every character from chars.
+std::string EscapeAll(std::string_view value, std::string_view chars, char escape);
+
+/// Splits value on sep, trimming whitespace around items; empty items are skipped.
+StringVector SplitTrimmed(std::string_view value, char sep);
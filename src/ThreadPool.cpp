@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threadCount)
+{
+    if (!threadCount)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    for (size_t i = 0; i < threadCount; ++i) {
+        workers.emplace_back([this] {
+            while (true) {
+                std::packaged_task<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+                    if (stopping)
+                        return;
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                }
+                task();
+            }
+        });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stopping = true;
+        tasks.clear();
+    }
+    condition.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+std::future<void> ThreadPool::Enqueue(std::function<void()> task)
+{
+    std::packaged_task<void()> packagedTask(std::move(task));
+    auto                       result = packagedTask.get_future();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        tasks.push_back(std::move(packagedTask));
+    }
+    condition.notify_one();
+    return result;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Fixed set of worker threads, executing tasks in order of enqueueing.
+class ThreadPool {
+    std::vector<std::thread>                workers;
+    std::deque<std::packaged_task<void()>> tasks;
+    std::mutex                              mutex;
+    std::condition_variable                 condition;
+    bool                                    stopping = false;
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+public:
+    /// Zero threadCount means number of hardware threads.
+    explicit ThreadPool(size_t threadCount = 0);
+
+    /// Tasks not yet started are discarded, running ones are waited.
+    ~ThreadPool();
+
+    /// Task exception is rethrown from returned future.
+    std::future<void> Enqueue(std::function<void()> task);
+
+    size_t GetThreadCount() const { return workers.size(); }
+};
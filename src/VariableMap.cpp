@@ -1,23 +1,8 @@
 #include "VariableMap.h"
+#include "StringKernels.h"
 
 #include <regex>
-#include <sstream>
-#include <cctype>
-
-namespace {
-
-static inline void trim(std::string& s)
-{
-    s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](int ch) {
-                return !std::isspace(ch);
-            }));
-    s.erase(std::find_if(s.rbegin(), s.rend(), [](int ch) {
-                return !std::isspace(ch);
-            }).base(),
-            s.end());
-}
-
-}
+#include <algorithm>
 
 std::string VariableMap::GetStrValue(const std::string& key) const
 {
@@ -64,7 +49,7 @@ bool VariableMap::GetBoolValue(const std::string& key, bool def) const
     return false;
 }
 
-void VariableMap::ParseFromXml(const std::string& blockName, const std::string& data)
+void VariableMap::ParseFromXml(const std::string& blockName, std::string_view data)
 {
     const auto blockBegin = data.find("<" + blockName + ">");
     if (blockBegin == std::string::npos)
@@ -73,39 +58,48 @@ void VariableMap::ParseFromXml(const std::string& blockName, const std::string&
     if (blockEnd == std::string::npos)
         return;
 
-    static const std::regex     re(R"rx(<(\w+)>([^<]+)</)rx", std::regex_constants::ECMAScript | std::regex_constants::optimize);
-    std::smatch                 res;
-    std::string::const_iterator searchStart2(data.cbegin() + blockBegin);
-    while (std::regex_search(searchStart2, data.cbegin() + blockEnd, res, re)) {
-        const std::string key   = res[1].str();
-        const std::string value = res[2].str();
+    static const std::regex re(R"rx(<(\w+)>([^<]+)</)rx", std::regex_constants::ECMAScript | std::regex_constants::optimize);
+    std::cmatch             res;
+    const char*             searchStart2 = data.data() + blockBegin;
+    while (std::regex_search(searchStart2, data.data() + blockEnd, res, re)) {
+        std::string key(res[1].first, res[1].second);
         //  std::cerr << key << "=" << value << std::endl;
-        variables[key] = value;
+        variables[std::move(key)].assign(res[2].first, res[2].second);
         searchStart2 += res.position() + res.length();
     }
 }
 
 std::string joinVector(const StringVector& lst, char sep)
 {
-    std::ostringstream ss;
-    ss << sep;
+    std::string result;
+    appendJoined(result, lst, "", sep);
+    return result;
+}
+
+void appendJoined(std::string& out, const StringVector& lst, const std::string& prefix, char sep, bool quoteSpaces)
+{
+    size_t size = out.size() + 1;
     for (const auto& el : lst)
-        ss << el << sep;
-    return ss.str();
+        size += prefix.size() + el.size() + 3;
+    out.reserve(size);
+
+    out += sep;
+    for (const auto& el : lst) {
+        const bool quote = quoteSpaces && el.find(' ') != std::string::npos;
+        out += prefix;
+        if (quote)
+            out += '"';
+        out += el;
+        if (quote)
+            out += '"';
+        out += sep;
+    }
 }
 
 StringVector strToList(const std::string& val, char sep)
 {
-    std::stringstream ss;
-    ss.str(val);
-    std::string  item;
-    StringVector result;
-    while (std::getline(ss, item, sep)) {
-        trim(item);
-        if (!item.empty() && item.at(0) != '%' && item.at(0) != '$') {
-            result.push_back(item);
-        }
-    }
+    StringVector result = SplitTrimmed(val, sep);
+    result.erase(std::remove_if(result.begin(), result.end(), [](const std::string& item) { return item[0] == '%' || item[0] == '$'; }), result.end());
     return result;
 }
 
@@ -4,8 +4,9 @@
 
 #include "CommonTypes.h"
 
+/// Property values of one project block.
 struct VariableMap {
-    std::map<std::string, std::string> variables;
+    std::map<std::string, std::string, StringViewLess> variables;
 
     std::string  GetStrValue(const std::string& key) const;
     std::string  GetStrValueFiltered(const std::string& key) const;
@@ -15,10 +16,11 @@ struct VariableMap {
 
     std::string& operator[](const std::string& key) { return variables[key]; }
 
-    void ParseFromXml(const std::string& blockName, const std::string& data);
+    void ParseFromXml(const std::string& blockName, std::string_view data);
 };
 
 std::ostream& operator<<(std::ostream& os, const VariableMap& info);
 
 std::string  joinVector(const StringVector& lst, char sep = ' ');
+void         appendJoined(std::string& out, const StringVector& lst, const std::string& prefix = "", char sep = ' ', bool quoteSpaces = false);
 StringVector strToList(const std::string& val, char sep = ';');
@@ -1,29 +1,251 @@
 #include <regex>
+#include <algorithm>
 #include <sstream>
 #include <fstream>
 #include <cassert>
+#include <cstdlib>
+#include <cctype>
 #include <iostream>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
 
 #include "VcProjectInfo.h"
 #include "FileUtils.h"
+#include "IncludeScanner.h"
+#include "FilePrefetcher.h"
+#include "StringKernels.h"
 
-void VcProjectInfo::ReadVcProj()
+namespace {
+/// CMake repeats same script text in every config and often in every project, so translations are shared by all threads.
+std::string FilterCommandScriptCached(std::string_view data)
 {
-    if (!FileInfo(baseDir + "/" + fileName).ReadFile(projectFileData))
+    static std::mutex                                        mutex;
+    static std::deque<std::string>                           scripts; // owns keys of translations.
+    static std::unordered_map<std::string_view, std::string> translations;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto                        it = translations.find(data);
+        if (it != translations.cend())
+            return it->second;
+    }
+    std::string result = VcProjectInfo::FilterCommandScript(data);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (translations.find(data) == translations.cend()) {
+        scripts.emplace_back(data);
+        translations.emplace(scripts.back(), result);
+    }
+    return result;
+}
+
+const std::string g_convertedMarker = "<!-- msbuild2ninja converted, hash=";
+const std::string g_modelExtension  = ".ninjamodel";
+const std::string g_modelVersion    = "3";
+const std::string g_moduleCompileAs = "CompileAsCppModule"; // prefix, also covering CompileAsCppModuleInternalPartition.
+
+/// .ixx is compiled as module interface by default.
+bool isModuleInterface(const std::string& path)
+{
+    std::string ext = path.substr(path.size() >= 4 ? path.size() - 4 : 0);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return static_cast<char>(::tolower(c)); });
+    return ext == ".ixx";
+}
+
+/// Removes linker options which conflict with fast developer link from space-separated flags; quoted arguments are kept whole.
+std::string removeFullLinkOptions(const std::string& flags)
+{
+    auto isRemoved = [](std::string token) {
+        if (token.size() < 2 || (token[0] != '/' && token[0] != '-'))
+            return false;
+        std::transform(token.begin(), token.end(), token.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        token[0] = '/';
+        return token == "/debug" || token.compare(0, 7, "/debug:") == 0 || token == "/incremental" || token == "/incremental:no"
+            || token.compare(0, 8, "/opt:ref") == 0 || token.compare(0, 8, "/opt:icf") == 0;
+    };
+    std::string result;
+    size_t      start    = 0;
+    bool        inQuotes = false;
+    for (size_t i = 0; i <= flags.size(); ++i) {
+        if (i < flags.size() && (flags[i] != ' ' || inQuotes)) {
+            if (flags[i] == '"')
+                inQuotes = !inQuotes;
+            continue;
+        }
+        const std::string token = flags.substr(start, i - start);
+        if (!token.empty() && !isRemoved(token))
+            result += (result.empty() ? "" : " ") + token;
+        start = i + 1;
+    }
+    return result;
+}
+
+/// Marker goes right after xml declaration; byte order mark, if any, stays first.
+size_t getMarkerPos(const std::string& data)
+{
+    const size_t start = data.compare(0, 3, "\xEF\xBB\xBF") == 0 ? 3 : 0;
+    if (data.compare(start, 5, "<?xml") != 0)
+        return start;
+    const auto pos = data.find('\n', start);
+    return pos == std::string::npos ? data.size() : pos + 1;
+}
+
+/// Length-prefixed strings, so any content survives.
+struct ModelWriter {
+    std::string data;
+
+    void Write(const std::string& value)
+    {
+        data += std::to_string(value.size());
+        data += ':';
+        data += value;
+        data += '\n';
+    }
+    void Write(const StringVector& values)
+    {
+        Write(std::to_string(values.size()));
+        for (const auto& value : values)
+            Write(value);
+    }
+};
+
+struct ModelReader {
+    const std::string& data;
+    size_t             pos = 0;
+
+    ModelReader(const std::string& data_)
+        : data(data_)
+    {}
+
+    bool Read(std::string& value)
+    {
+        const auto colon = data.find(':', pos);
+        if (colon == std::string::npos)
+            return false;
+        const size_t size = std::strtoull(data.c_str() + pos, nullptr, 10);
+        if (colon + 1 + size >= data.size())
+            return false;
+        value.assign(data, colon + 1, size);
+        pos = colon + 1 + size + 1;
+        return true;
+    }
+    bool Read(StringVector& values)
+    {
+        std::string count;
+        if (!Read(count))
+            return false;
+        values.resize(std::strtoull(count.c_str(), nullptr, 10));
+        for (auto& value : values) {
+            if (!Read(value))
+                return false;
+        }
+        return true;
+    }
+    bool AtEnd() const { return pos == data.size(); }
+};
+}
+
+StringVector VcProjectInfo::GetInputFiles() const
+{
+    const std::string path = baseDir + "/" + fileName;
+    return { path, path + ".filters", path + g_modelExtension };
+}
+
+void VcProjectInfo::ReadVcProj(FilePrefetcher& files)
+{
+    if (!files.Read(baseDir + "/" + fileName, projectFileData))
         throw std::runtime_error("Failed to read project file");
-    if (!FileInfo(baseDir + "/" + fileName + ".filters").ReadFile(projectFiltersData))
+    if (!files.Read(baseDir + "/" + fileName + ".filters", projectFiltersData))
         throw std::runtime_error("Failed to read project file");
 }
 
-void VcProjectInfo::WriteVcProj()
+void VcProjectInfo::WriteVcProj(const std::string& settingsKey)
 {
-    if (!FileInfo(baseDir + "/" + fileName).WriteFile(projectFileData))
+    const std::string contentHash = std::to_string(FastHash(projectFileData));
+    const std::string markedData  = projectFileData.substr(0, getMarkerPos(projectFileData)) + g_convertedMarker + contentHash + " -->\n" + projectFileData.substr(getMarkerPos(projectFileData));
+    if (!FileInfo(baseDir + "/" + fileName).WriteFile(markedData))
         throw std::runtime_error("Failed to write file:" + fileName);
     if (!FileInfo(baseDir + "/" + fileName + ".filters").WriteFile(projectFiltersData))
         throw std::runtime_error("Failed to write file:" + fileName);
+
+    ModelWriter model;
+    model.Write(g_modelVersion);
+    model.Write(settingsKey);
+    model.Write(contentHash);
+    model.Write(std::to_string(static_cast<int>(type)));
+    model.Write(clCompileFiles);
+    model.Write(rcCompileFiles);
+    model.Write(std::to_string(parsedConfigs.size()));
+    for (const ParsedConfig& pc : parsedConfigs) {
+        for (const std::string* field : { &pc.name, &pc.platform, &pc.platformSuffix, &pc.outDir, &pc.intDir, &pc.targetName, &pc.targetMainExt, &pc.targetImportExt })
+            model.Write(*field);
+        model.Write(pc.usesModules ? "1" : "0");
+        for (const StringVector* field : { &pc.includes, &pc.defines, &pc.flags, &pc.link, &pc.linkFlags })
+            model.Write(*field);
+        model.Write(std::to_string(pc.customCommands.size()));
+        for (const CustomBuild& rule : pc.customCommands) {
+            model.Write(rule.message);
+            model.Write(rule.deps);
+            model.Write(rule.output);
+            model.Write(rule.additionalOutputs);
+            model.Write(rule.command);
+        }
+    }
+    if (!FileInfo(baseDir + "/" + fileName + g_modelExtension).WriteFile(model.data))
+        throw std::runtime_error("Failed to write file:" + fileName + g_modelExtension);
+}
+
+bool VcProjectInfo::LoadConvertedModel(const std::string& settingsKey, FilePrefetcher& files)
+{
+    // taken even if unused, so prefetch does not keep model file open while it is rewritten.
+    std::string data;
+    files.Read(baseDir + "/" + fileName + g_modelExtension, data);
+
+    const size_t markerPos = getMarkerPos(projectFileData);
+    if (projectFileData.compare(markerPos, g_convertedMarker.size(), g_convertedMarker) != 0)
+        return false;
+
+    const size_t hashPos     = markerPos + g_convertedMarker.size();
+    const size_t markerEnd   = projectFileData.find('\n', hashPos);
+    const auto   contentHash = projectFileData.substr(hashPos, projectFileData.find(' ', hashPos) - hashPos);
+    if (markerEnd == std::string::npos || contentHash != std::to_string(FastHash(projectFileData.substr(0, markerPos) + projectFileData.substr(markerEnd + 1))))
+        throw std::runtime_error("Converted project was modified: " + fileName + ", regenerate it with CMake");
+
+    ModelReader model(data);
+    std::string version, key, hash, typeStr, count;
+    if (!model.Read(version) || version != g_modelVersion || !model.Read(key) || key != settingsKey || !model.Read(hash) || hash != contentHash)
+        throw std::runtime_error("Project was converted with other settings: " + fileName + ", regenerate it with CMake");
+
+    model.Read(typeStr);
+    type = static_cast<Type>(std::atoi(typeStr.c_str()));
+    model.Read(clCompileFiles);
+    model.Read(rcCompileFiles);
+    model.Read(count);
+    parsedConfigs.resize(std::atoi(count.c_str()));
+    for (ParsedConfig& pc : parsedConfigs) {
+        for (std::string* field : { &pc.name, &pc.platform, &pc.platformSuffix, &pc.outDir, &pc.intDir, &pc.targetName, &pc.targetMainExt, &pc.targetImportExt })
+            model.Read(*field);
+        std::string usesModulesStr;
+        model.Read(usesModulesStr);
+        pc.usesModules = usesModulesStr == "1";
+        for (StringVector* field : { &pc.includes, &pc.defines, &pc.flags, &pc.link, &pc.linkFlags })
+            model.Read(*field);
+        model.Read(count);
+        pc.customCommands.resize(std::atoi(count.c_str()));
+        for (CustomBuild& rule : pc.customCommands) {
+            model.Read(rule.message);
+            model.Read(rule.deps);
+            model.Read(rule.output);
+            model.Read(rule.additionalOutputs);
+            model.Read(rule.command);
+        }
+    }
+    if (!model.AtEnd())
+        throw std::runtime_error("Broken model file for " + fileName + ", regenerate it with CMake");
+    return true;
 }
 
-void VcProjectInfo::ParseConfigs()
+void VcProjectInfo::ParseConfigs(const StringVector& configurations, const StringVector& platforms)
 {
     {
         auto parseIncludes = [this](StringVector& result, const std::string& tag) {
@@ -63,50 +285,90 @@ void VcProjectInfo::ParseConfigs()
     if (type == Type::Unknown)
         return;
 
-    std::map<std::string, VariableMap> projectProperties;
-    {
-        auto                    start = projectFileData.find("/_ProjectFileVersion");
-        auto                    end   = projectFileData.find("/PropertyGroup", start);
-        static const std::regex exp2(R"rx(<(\w+) Condition="'\$\(Configuration\)\|\$\(Platform\)'=='(\w+)\|(\w+)'">([^<]+)</)rx", std::regex_constants::ECMAScript | std::regex_constants::optimize);
-
-        std::string::const_iterator searchStart(projectFileData.cbegin() + start);
-        std::smatch                 res;
-        while (std::regex_search(searchStart, projectFileData.cbegin() + end, res, exp2)) {
-            searchStart += res.position() + res.length();
+    // only requested configurations are parsed; others are skipped right after reading condition.
+    auto isRequested = [&configurations, &platforms](const std::string& configuration, const std::string& platform) {
+        return std::find(configurations.cbegin(), configurations.cend(), configuration) != configurations.cend()
+               && (platforms.empty() || std::find(platforms.cbegin(), platforms.cend(), platform) != platforms.cend());
+    };
+    // reads "Configuration|Platform'">" after condition mark, returns position after it or npos.
+    auto parseCondition = [this](size_t pos, std::string& configuration, std::string& platform) -> size_t {
+        const auto sep = projectFileData.find('|', pos);
+        const auto end = projectFileData.find("'\">", pos);
+        if (sep == std::string::npos || end == std::string::npos || sep > end)
+            return std::string::npos;
+        configuration.assign(projectFileData, pos, sep - pos);
+        platform.assign(projectFileData, sep + 1, end - sep - 1);
+        return end + 3;
+    };
+    const std::string conditionMark = "Condition=\"'$(Configuration)|$(Platform)'=='";
 
-            std::string key                       = res[1].str();
-            std::string configuration             = res[2].str();
-            std::string value                     = res[4].str();
-            projectProperties[configuration][key] = value;
-        }
+    std::map<std::string, VariableMap> projectProperties;
+    const auto                         propertiesStart = projectFileData.find("/_ProjectFileVersion");
+    const auto                         propertiesEnd   = projectFileData.find("/PropertyGroup", propertiesStart);
+    for (auto pos = projectFileData.find(conditionMark, propertiesStart); pos < propertiesEnd; pos = projectFileData.find(conditionMark, pos)) {
+        // <Key Condition="...">Value</Key>
+        const auto  keyStart = projectFileData.rfind('<', pos) + 1;
+        std::string configuration, platform;
+        pos = parseCondition(pos + conditionMark.size(), configuration, platform);
+        if (pos == std::string::npos)
+            break;
+        const auto valueEnd = projectFileData.find('<', pos);
+        if (valueEnd == std::string::npos || valueEnd == pos || !isRequested(configuration, platform))
+            continue;
+        const std::string key                                   = projectFileData.substr(keyStart, projectFileData.find(' ', keyStart) - keyStart);
+        projectProperties[configuration + "|" + platform][key] = projectFileData.substr(pos, valueEnd - pos);
     }
 
-    std::smatch             res;
-    static const std::regex exp3(R"rx(<ItemDefinitionGroup Condition="'\$\(Configuration\)\|\$\(Platform\)'=='(\w+)\|(\w+)'">\s*)rx", std::regex_constants::ECMAScript | std::regex_constants::optimize);
-
-    std::string::const_iterator searchStart(projectFileData.cbegin());
-    while (std::regex_search(searchStart, projectFileData.cend(), res, exp3)) {
-        searchStart += res.position() + res.length();
-        auto        off  = searchStart - projectFileData.cbegin();
-        auto        next = projectFileData.find("</ItemDefinitionGroup>", off);
-        std::string deps = projectFileData.substr(off, next - off);
-
+    const std::string groupMark = "<ItemDefinitionGroup " + conditionMark;
+    for (auto pos = projectFileData.find(groupMark); pos != std::string::npos; pos = projectFileData.find(groupMark, pos)) {
         Config config;
-        config.configuration = res[1].str();
-        config.platform      = res[2].str();
+        pos = parseCondition(pos + groupMark.size(), config.configuration, config.platform);
+        if (pos == std::string::npos)
+            break;
+        if (!isRequested(config.configuration, config.platform))
+            continue;
+        const auto             next = projectFileData.find("</ItemDefinitionGroup>", pos);
+        const std::string_view deps(projectFileData.data() + pos, (next == std::string::npos ? projectFileData.size() : next) - pos);
 
-        config.projectVariables = projectProperties[config.configuration];
+        config.projectVariables = std::move(projectProperties[config.configuration + "|" + config.platform]);
 
         config.clVariables.ParseFromXml("ClCompile", deps);
         config.libVariables.ParseFromXml("Lib", deps);
         config.linkVariables.ParseFromXml("Link", deps);
 
-        configs.push_back(config);
+        configs.push_back(std::move(config));
+    }
+
+    // CompileAs of item applies to configs of its condition, or to all of them.
+    const std::string itemMark = "<ClCompile Include=\"", compileAsMark = "<CompileAs";
+    for (auto pos = projectFileData.find(itemMark); pos != std::string::npos; pos = projectFileData.find(itemMark, pos)) {
+        pos = projectFileData.find('>', pos);
+        if (pos == std::string::npos)
+            break;
+        if (projectFileData[pos - 1] == '/')
+            continue;
+        const auto itemEnd = projectFileData.find("</ClCompile>", pos);
+        for (auto metaPos = projectFileData.find(compileAsMark, pos); metaPos < itemEnd; metaPos = projectFileData.find(compileAsMark, metaPos + 1)) {
+            // <CompileAs Condition="...">Value</CompileAs>, not CompileAsManaged or CompileAsWinRT.
+            const auto nameEnd = metaPos + compileAsMark.size();
+            if (projectFileData[nameEnd] != '>' && projectFileData[nameEnd] != ' ')
+                continue;
+            std::string configuration, platform;
+            const bool  conditional = projectFileData.compare(nameEnd + 1, conditionMark.size(), conditionMark) == 0;
+            if (conditional && parseCondition(nameEnd + 1 + conditionMark.size(), configuration, platform) == std::string::npos)
+                continue;
+            if (projectFileData.compare(projectFileData.find('>', nameEnd) + 1, g_moduleCompileAs.size(), g_moduleCompileAs) != 0)
+                continue;
+            for (Config& config : configs) {
+                if (!conditional || (config.configuration == configuration && config.platform == platform))
+                    config.hasModuleItems = true;
+            }
+        }
     }
     //std::cout << "ParseConfigs: " << targetName << std::endl;
 }
 
-void VcProjectInfo::TransformConfigs(const StringVector& configurations, const std::string& rootDir)
+void VcProjectInfo::TransformConfigs(const StringVector& configurations, const StringVector& platforms, const std::string& rootDir, bool embedDebugInfo, bool fastLink)
 {
     auto filterLinkLibraries = [](const StringVector& libs, const std::string& config) -> StringVector {
         StringVector result;
@@ -125,11 +387,19 @@ void VcProjectInfo::TransformConfigs(const StringVector& configurations, const s
             return {};
         return "/Wv:" + version;
     };
+    std::vector<const Config*> selectedConfigs;
     for (const auto& configName : configurations) {
-        auto configIt = std::find_if(configs.begin(), configs.end(), [&configName](const Config& config) { return config.configuration == configName; });
-        if (configIt == configs.end())
-            continue;
-        const Config& config = *configIt;
+        for (const Config& config : configs) {
+            if (config.configuration != configName)
+                continue;
+            if (!platforms.empty() && std::find(platforms.cbegin(), platforms.cend(), config.platform) == platforms.cend())
+                continue;
+            selectedConfigs.push_back(&config);
+        }
+    }
+    const bool hasModuleInterfaces = std::any_of(clCompileFiles.cbegin(), clCompileFiles.cend(), [](const std::string& file) { return isModuleInterface(file); });
+    for (const Config* configPtr : selectedConfigs) {
+        const Config& config = *configPtr;
 
         ParsedConfig pc;
         pc.name          = config.configuration;
@@ -141,7 +411,7 @@ void VcProjectInfo::TransformConfigs(const StringVector& configurations, const s
         pc.targetMainExt = config.projectVariables.GetStrValue("TargetExt");
         pc.outDir        = config.projectVariables.GetStrValue("OutDir");
         pc.intDir        = config.projectVariables.GetStrValue("IntDir");
-        std::replace(pc.outDir.begin(), pc.outDir.end(), '/', '\\');
+        ReplaceAll(pc.outDir, "/", '\\');
 
         if (pc.targetName.empty())
             pc.targetName = targetName;
@@ -151,6 +421,7 @@ void VcProjectInfo::TransformConfigs(const StringVector& configurations, const s
             pc.outDir = pc.name + "_";
 
         pc.targetImportExt = type == Type::Dynamic ? ".lib" : "";
+        pc.usesModules     = hasModuleInterfaces || config.hasModuleItems || config.clVariables.GetStrValue("CompileAs").compare(0, g_moduleCompileAs.size(), g_moduleCompileAs) == 0;
 
         auto flagsProcess = [&pc, &config](const std::string& key, const std::map<std::string, std::string>& mapping) {
             std::string t = config.clVariables.GetMappedValue(key, mapping);
@@ -170,7 +441,10 @@ void VcProjectInfo::TransformConfigs(const StringVector& configurations, const s
         flagsProcess("RuntimeLibrary", { { "MultiThreadedDLL", "/MD" }, { "MultiThreadedDebugDLL", "/MDd" }, { "MultiThreaded", "/MT" }, { "MultiThreadedDebug", "/MTd" } });
         flagsProcess("ExceptionHandling", { { "Sync", "/EHsc" } });
         flagsProcess("Optimization", { { "Disabled", "/Od" }, { "MinSpace", "/O1" }, { "MaxSpeed", "/O2" } });
-        flagsProcess("DebugInformationFormat", { { "ProgramDatabase", "/Zi" } });
+        if (embedDebugInfo)
+            flagsProcess("DebugInformationFormat", { { "ProgramDatabase", "/Z7" }, { "EditAndContinue", "/Z7" }, { "OldStyle", "/Z7" } });
+        else
+            flagsProcess("DebugInformationFormat", { { "ProgramDatabase", "/Zi" } });
         flagsProcess("BasicRuntimeChecks", { { "EnableFastChecks", "/RTC1" } });
         flagsProcess("RuntimeTypeInfo", { { "true", "/GR" } });
         flagsProcess("WarningLevel", { { "Level1", "/W1" }, { "Level2", "/W2" }, { "Level3", "/W3" } });
@@ -216,11 +490,67 @@ void VcProjectInfo::TransformConfigs(const StringVector& configurations, const s
         if (config.projectVariables.GetBoolValue("LinkIncremental"))
             pc.linkFlags.push_back("/INCREMENTAL");
 
+        // pdb references objects instead of merging their debug info, and unchanged code is not relinked.
+        if (fastLink && (type == Type::App || type == Type::Dynamic)) {
+            StringVector linkFlags;
+            for (const auto& flags : pc.linkFlags) {
+                auto filtered = removeFullLinkOptions(flags);
+                if (!filtered.empty())
+                    linkFlags.push_back(std::move(filtered));
+            }
+            linkFlags.push_back("/DEBUG:FASTLINK");
+            linkFlags.push_back("/INCREMENTAL");
+            pc.linkFlags = std::move(linkFlags);
+        }
+
         parsedConfigs.push_back(pc);
     }
+
+    std::set<std::string> usedPlatforms;
+    for (const ParsedConfig& pc : parsedConfigs)
+        usedPlatforms.insert(pc.platform);
+    if (usedPlatforms.size() < 2)
+        return;
+
+    // make directories unique per platform when project does not do it itself.
+    auto appendSuffixToDir = [](std::string& dir, const std::string& suffix) {
+        const bool endSlash = !dir.empty() && dir.back() == '\\';
+        if (endSlash)
+            dir.pop_back();
+        dir += suffix;
+        if (endSlash)
+            dir += '\\';
+    };
+    auto isDirShared = [this](const ParsedConfig& pc, std::string ParsedConfig::*dir) {
+        return std::any_of(parsedConfigs.cbegin(), parsedConfigs.cend(), [&pc, dir](const ParsedConfig& other) {
+            return other.name == pc.name && other.platform != pc.platform && other.*dir == pc.*dir;
+        });
+    };
+    std::vector<ParsedConfig> result = parsedConfigs;
+    for (size_t i = 0; i < result.size(); ++i) {
+        ParsedConfig& pc  = result[i];
+        pc.platformSuffix = "_" + pc.platform;
+        if (type == Type::Utility)
+            pc.outDir = pc.getId() + "_";
+        else if (isDirShared(parsedConfigs[i], &ParsedConfig::outDir))
+            appendSuffixToDir(pc.outDir, pc.platformSuffix);
+        if (isDirShared(parsedConfigs[i], &ParsedConfig::intDir))
+            appendSuffixToDir(pc.intDir, pc.platformSuffix);
+    }
+    parsedConfigs = std::move(result);
+}
+
+const VcProjectInfo::ParsedConfig* VcProjectInfo::FindParsedConfig(const std::string& name, const std::string& platform) const
+{
+    // outputs of other platform must not be linked or waited for, so only exact pair matches.
+    for (const ParsedConfig& pc : parsedConfigs) {
+        if (pc.name == name && pc.platform == platform)
+            return &pc;
+    }
+    return nullptr;
 }
 
-void VcProjectInfo::ConvertToMakefile(const std::string& ninjaBin, const StringVector& customDeps)
+void VcProjectInfo::ConvertToMakefile(const std::string& ninjaBin, const StringVector& customDeps, bool directTargets)
 {
     if (type == Type::Unknown)
         return;
@@ -261,9 +591,10 @@ void VcProjectInfo::ConvertToMakefile(const std::string& ninjaBin, const StringV
 
     std::ostringstream os;
     for (const ParsedConfig& config : parsedConfigs) {
+        const std::string target = directTargets ? "\"" + config.getOutputNameWithDir() + "\"" : config.getOutputAlias();
         os << "<PropertyGroup Condition=\"'$(Configuration)|$(Platform)'=='" << config.name << "|" << config.platform << "'\">\n"
-           << "  <NMakeBuildCommandLine>\"" << ninjaBin << "\" " << config.getOutputAlias() << "</NMakeBuildCommandLine>\n"
-           << "  <NMakeReBuildCommandLine>\"" << ninjaBin << "\" -t clean &amp;&amp; \"" << ninjaBin << "\" " << config.getOutputAlias() << "</NMakeReBuildCommandLine>\n"
+           << "  <NMakeBuildCommandLine>\"" << ninjaBin << "\" " << target << "</NMakeBuildCommandLine>\n"
+           << "  <NMakeReBuildCommandLine>\"" << ninjaBin << "\" -t clean &amp;&amp; \"" << ninjaBin << "\" " << target << "</NMakeReBuildCommandLine>\n"
            << "  <NMakeCleanCommandLine>\"" << ninjaBin << "\" -t clean</NMakeCleanCommandLine>\n"
            << "  <NMakePreprocessorDefinitions>" << joinVector(config.defines, ';') << "</NMakePreprocessorDefinitions>\n"
            << "  <NMakeIncludeSearchPath>" << joinVector(config.includes, ';') << "</NMakeIncludeSearchPath>\n"
@@ -274,7 +605,7 @@ void VcProjectInfo::ConvertToMakefile(const std::string& ninjaBin, const StringV
     auto              pos               = projectFileData.rfind(lastPropertyGroup);
     projectFileData.insert(projectFileData.begin() + pos + lastPropertyGroup.size(), nmakeProperties.cbegin(), nmakeProperties.cend());
 
-    auto extractParam = [this](const std::string& data, const std::string& name, const std::string& configName, const std::string& configPlatform) {
+    auto extractParam = [](std::string_view data, const std::string& name, const std::string& configName, const std::string& configPlatform) {
         const std::string startMark = "<" + name + " Condition=\"'$(Configuration)|$(Platform)'=='" + configName + "|" + configPlatform + "'\">";
         const std::string endMark   = "</" + name + ">";
         auto              startPos  = data.find(startMark);
@@ -282,24 +613,6 @@ void VcProjectInfo::ConvertToMakefile(const std::string& ninjaBin, const StringV
         return data.substr(startPos + startMark.size(), endPos - startPos - startMark.size());
     };
 
-    auto filterCommandScript = [](const std::string& data) -> std::string {
-        static const std::regex re("(if |exit |setlocal|endlocal|:).*[\r]?", std::regex_constants::ECMAScript | std::regex_constants::optimize);
-        static const std::regex reNL("[\r\n]", std::regex_constants::ECMAScript | std::regex_constants::optimize);
-        auto                    lines  = strToList(data, '\n');
-        std::string             result = "";
-        for (const auto& line : lines) {
-            if (line.size() < 4)
-                continue;
-            if (std::regex_match(line, re))
-                continue;
-
-            if (!result.empty())
-                result += " && ";
-            result += std::regex_replace(line, reNL, "");
-        }
-        return result;
-    };
-
     auto filterCustomInputs = [](const StringVector& inputs) -> StringVector {
         StringVector result;
         bool         ignoreAll = false;
@@ -316,15 +629,15 @@ void VcProjectInfo::ConvertToMakefile(const std::string& ninjaBin, const StringV
         return result;
     };
 
-    while (true) {
-        auto startPos = projectFileData.find("<CustomBuild ");
-        if (startPos == std::string::npos)
-            break;
-
-        const std::string endCustomBuild  = "</CustomBuild>";
-        auto              endPos          = projectFileData.find(endCustomBuild, startPos);
-        const std::string customBuildRule = projectFileData.substr(startPos, endPos - startPos);
-        projectFileData.erase(projectFileData.begin() + startPos, projectFileData.begin() + endPos + endCustomBuild.size());
+    // rules are cut out in one pass over project text; erasing them one by one is quadratic on big projects.
+    const std::string endCustomBuild = "</CustomBuild>";
+    std::string       remainingData;
+    size_t            copiedPos = 0;
+    for (size_t startPos; (startPos = projectFileData.find("<CustomBuild ", copiedPos)) != std::string::npos;) {
+        const auto             endPos = projectFileData.find(endCustomBuild, startPos);
+        const std::string_view customBuildRule(projectFileData.data() + startPos, endPos - startPos);
+        remainingData.append(projectFileData, copiedPos, startPos - copiedPos);
+        copiedPos = endPos + endCustomBuild.size();
 
         StringVector      includes;
         const std::string includeStartMark = "Include=\"";
@@ -332,7 +645,7 @@ void VcProjectInfo::ConvertToMakefile(const std::string& ninjaBin, const StringV
         if (includeStartPos != std::string::npos) {
             auto includeEndPos = customBuildRule.find("\">", includeStartPos);
             if (includeEndPos != std::string::npos) {
-                includes = strToList(customBuildRule.substr(includeStartPos + includeStartMark.length(), includeEndPos - includeStartPos - includeStartMark.length()));
+                includes = strToList(std::string(customBuildRule.substr(includeStartPos + includeStartMark.length(), includeEndPos - includeStartPos - includeStartMark.length())));
             }
         }
 
@@ -346,14 +659,14 @@ void VcProjectInfo::ConvertToMakefile(const std::string& ninjaBin, const StringV
             if (rule.output.find("generate.stamp") != std::string::npos)
                 continue;
             if (rule.output.find("CMakeFiles") != std::string::npos) // hack! this allows phony rules be different on debug and release, but real outputs (e.g. resources) be the same.
-                rule.output += "\\" + config.name;
+                rule.output += "\\" + config.getId();
             if (rule.output.find(";") != std::string::npos) {
                 auto outputs = strToList(rule.output);
                 rule.output  = outputs[0];
                 outputs.erase(outputs.begin());
                 rule.additionalOutputs = outputs;
             }
-            auto inputs = strToList(extractParamConfig("AdditionalInputs"));
+            auto inputs = strToList(std::string(extractParamConfig("AdditionalInputs")));
             inputs.insert(inputs.end(), includes.begin(), includes.end());
             inputs = filterCustomInputs(inputs);
             if (inputs.empty())
@@ -361,12 +674,32 @@ void VcProjectInfo::ConvertToMakefile(const std::string& ninjaBin, const StringV
             if (inputs.empty())
                 continue;
             rule.deps    = inputs;
-            rule.command = filterCommandScript(extractParamConfig("Command"));
+            rule.command = FilterCommandScriptCached(extractParamConfig("Command"));
 
             if (!inputs.empty())
                 config.customCommands.push_back(rule);
         }
     }
+    remainingData.append(projectFileData, copiedPos, std::string::npos);
+    projectFileData = std::move(remainingData);
+}
+
+void VcProjectInfo::ReleaseData()
+{
+    projectFileData    = {};
+    projectFiltersData = {};
+    clCompileFiles     = {};
+    rcCompileFiles     = {};
+    configs            = {};
+    for (ParsedConfig& pc : parsedConfigs) {
+        pc.defines        = {};
+        pc.flags          = {};
+        pc.link           = {};
+        pc.linkFlags      = {};
+        pc.customCommands = {};
+        pc.generatedIncludes.reset();
+        pc.fragments.reset();
+    }
 }
 
 void VcProjectInfo::CalculateDependentTargets(const std::vector<VcProjectInfo>& allTargets)
@@ -379,6 +712,115 @@ void VcProjectInfo::CalculateDependentTargets(const std::vector<VcProjectInfo>&
     }
 }
 
+void VcProjectInfo::ScanGeneratedIncludes(IncludeScanner& scanner)
+{
+    for (ParsedConfig& pc : parsedConfigs) {
+        pc.generatedIncludes.emplace();
+        std::map<std::string, std::string> generatedHeaders; // normalized -> as written in rules.
+        for (const CustomBuild& rule : pc.customCommands) {
+            for (const std::string& output : rule.additionalOutputs) {
+                if (IsHeaderFile(output))
+                    generatedHeaders.emplace(IncludeScanner::NormalizePath(output), output);
+            }
+            if (IsHeaderFile(rule.output))
+                generatedHeaders.emplace(IncludeScanner::NormalizePath(rule.output), rule.output);
+        }
+        if (generatedHeaders.empty())
+            continue;
+
+        StringVector headerList;
+        for (const auto& header : generatedHeaders)
+            headerList.push_back(header.second);
+        scanner.AddGeneratedFiles(headerList);
+
+        for (const auto& source : clCompileFiles) {
+            for (const auto& header : scanner.ScanTransitive(source, pc.includes)) {
+                auto it = generatedHeaders.find(IncludeScanner::NormalizePath(header));
+                if (it != generatedHeaders.cend())
+                    (*pc.generatedIncludes)[source].push_back(it->second);
+            }
+        }
+    }
+}
+
+std::string VcProjectInfo::FilterCommandScript(std::string_view data)
+{
+    static const std::string_view skippedPrefixes[] = { "if ", "exit ", "setlocal", "endlocal", ":" };
+    auto                          isSpace           = [](char c) { return std::isspace(static_cast<unsigned char>(c)) != 0; };
+
+    std::string result;
+    size_t      pos = 0;
+    while (pos < data.size()) {
+        const size_t     lineEnd = std::min(data.find('\n', pos), data.size());
+        std::string_view line    = data.substr(pos, lineEnd - pos);
+        pos                      = lineEnd + 1;
+        while (!line.empty() && isSpace(line.front()))
+            line.remove_prefix(1);
+        while (!line.empty() && isSpace(line.back()))
+            line.remove_suffix(1);
+        if (line.size() < 4 || line[0] == '%' || line[0] == '$')
+            continue;
+        const bool hasCR = line.find('\r') != std::string_view::npos;
+        if (!hasCR && std::any_of(std::begin(skippedPrefixes), std::end(skippedPrefixes), [line](std::string_view prefix) { return line.compare(0, prefix.size(), prefix) == 0; }))
+            continue;
+
+        if (!result.empty())
+            result += " && ";
+        for (size_t cr; (cr = line.find('\r')) != std::string_view::npos; line.remove_prefix(cr + 1))
+            result.append(line.data(), cr);
+        result.append(line.data(), line.size());
+    }
+    return result;
+}
+
+bool VcProjectInfo::IsHeaderFile(const std::string& path)
+{
+    static const StringVector extensions{ ".h", ".hh", ".hpp", ".hxx", ".inl", ".inc", ".ipp" };
+    const auto                dot = path.rfind('.');
+    if (dot == std::string::npos)
+        return false;
+    std::string ext = path.substr(dot);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return static_cast<char>(::tolower(c)); });
+    return std::find(extensions.cbegin(), extensions.cend(), ext) != extensions.cend();
+}
+
+std::vector<std::vector<VcProjectInfo*>> CalculateDependencyLevels(VcProjectList& projects)
+{
+    std::set<const VcProjectInfo*> processed;
+    std::vector<VcProjectInfo*>    pending;
+    for (auto& p : projects)
+        pending.push_back(&p);
+
+    std::vector<std::vector<VcProjectInfo*>> result;
+    while (!pending.empty()) {
+        std::vector<VcProjectInfo*> level, rest;
+        for (VcProjectInfo* p : pending) {
+            const bool ready = std::all_of(p->dependentTargets.cbegin(), p->dependentTargets.cend(), [&processed](const VcProjectInfo* dep) {
+                return processed.count(dep) > 0;
+            });
+            (ready ? level : rest).push_back(p);
+        }
+        if (level.empty()) {
+            // every rest project has dependency in rest, so walking first dependencies must return to visited one.
+            std::vector<const VcProjectInfo*> chain{ rest[0] };
+            while (std::find(chain.cbegin(), chain.cend() - 1, chain.back()) == chain.cend() - 1) {
+                const VcProjectInfo* current = chain.back();
+                chain.push_back(*std::find_if(current->dependentTargets.cbegin(), current->dependentTargets.cend(), [&processed](const VcProjectInfo* dep) {
+                    return processed.count(dep) == 0;
+                }));
+            }
+            std::string chainStr;
+            for (auto it = std::find(chain.cbegin(), chain.cend(), chain.back()); it != chain.cend(); ++it)
+                chainStr += (chainStr.empty() ? "" : " -> ") + (*it)->targetName + " {" + (*it)->GUID + "}";
+            throw std::runtime_error("Dependency cycle detected: " + chainStr);
+        }
+        processed.insert(level.cbegin(), level.cend());
+        result.push_back(std::move(level));
+        pending = std::move(rest);
+    }
+    return result;
+}
+
 std::ostream& operator<<(std::ostream& os, const VcProjectInfo::Config& info)
 {
     os << "config (" << info.configuration << "|" << info.platform << "):";
@@ -389,7 +831,7 @@ std::ostream& operator<<(std::ostream& os, const VcProjectInfo::Config& info)
 
 std::ostream& operator<<(std::ostream& os, const VcProjectInfo::ParsedConfig& info)
 {
-    os << "PREPARED (" << info.name << "): \n";
+    os << "PREPARED (" << info.name << "|" << info.platform << "): \n";
     os << "\t\tINCLUDES=" << info.includes << "\n";
     os << "\t\tDEFINES=" << info.defines << "\n";
     os << "\t\tFLAGS=" << info.flags << "\n";
@@ -417,8 +859,21 @@ std::ostream& operator<<(std::ostream& os, const VcProjectInfo& info)
 std::string VcProjectInfo::ParsedConfig::getOutputAlias() const
 {
     std::string result = getOutputNameWithDir();
-    std::replace(result.begin(), result.end(), ' ', '_');
-    std::replace(result.begin(), result.end(), '/', '_');
-    std::replace(result.begin(), result.end(), '\\', '_');
+    ReplaceAll(result, " /\\", '_');
     return result;
 }
+
+const VcProjectInfo::ParsedConfig::Fragments& VcProjectInfo::ParsedConfig::getFragments() const
+{
+    if (fragments)
+        return *fragments;
+
+    Fragments result;
+    appendJoined(result.flags, flags);
+    appendJoined(result.defines, defines, "/D");
+    appendJoined(result.includes, includes, "/I", ' ', true);
+    appendJoined(result.linkFlags, linkFlags);
+    appendJoined(result.linkLibraries, link);
+    fragments = std::move(result);
+    return *fragments;
+}
@@ -1,11 +1,15 @@
 #pragma once
 #include <map>
 #include <set>
+#include <optional>
 
 #include "CommonTypes.h"
 #include "VariableMap.h"
 #include "NinjaWriter.h"
 
+class IncludeScanner;
+class FilePrefetcher;
+
 struct VcProjectInfo {
     std::string baseDir;
     std::string targetName;
@@ -26,6 +30,7 @@ struct VcProjectInfo {
         VariableMap clVariables;
         VariableMap libVariables;
         VariableMap linkVariables;
+        bool        hasModuleItems = false; // some ClCompile item is compiled as module unit in this config.
     };
     std::vector<Config> configs;
     struct CustomBuild {
@@ -39,12 +44,14 @@ struct VcProjectInfo {
     struct ParsedConfig {
         std::string name;
         std::string platform;
+        std::string platformSuffix; // "_<platform>" when several platforms of project are converted, empty otherwise.
 
         std::string outDir;
         std::string intDir;
         std::string targetName;
         std::string targetMainExt;
         std::string targetImportExt;
+        bool        usesModules = false; // has C++20 module units: .ixx sources or CompileAs CompileAsCppModule.
 
         StringVector includes;
         StringVector defines;
@@ -54,14 +61,33 @@ struct VcProjectInfo {
 
         std::vector<CustomBuild> customCommands;
 
+        /// Source -> generated headers of customCommands it includes. Not set unless ScanGeneratedIncludes was done.
+        std::optional<std::map<std::string, StringVector>> generatedIncludes;
+
+        /// Command line fragments, joined once and shared by every build edge of config.
+        struct Fragments {
+            std::string flags;
+            std::string defines;
+            std::string includes;
+            std::string linkFlags;
+            std::string linkLibraries;
+        };
+        mutable std::optional<Fragments> fragments;
+
+        const Fragments& getFragments() const;
+
         std::string getOutputName() const { return targetName + targetMainExt; }
         std::string getOutputNameWithDir() const { return outDir + getOutputName(); }
         std::string getOutputAlias() const;
         std::string getImportName() const { return targetImportExt.empty() ? "" : targetName + targetImportExt; }
         std::string getImportNameWithDir() const { return targetImportExt.empty() ? "" : intDir + getImportName(); }
+        std::string getId() const { return name + platformSuffix; }
     };
     std::vector<ParsedConfig> parsedConfigs;
 
+    /// Config with both name and platform matching, nullptr if project does not have it.
+    const ParsedConfig* FindParsedConfig(const std::string& name, const std::string& platform) const;
+
     enum class Type
     {
         Unknown,
@@ -71,15 +97,37 @@ struct VcProjectInfo {
         Utility
     };
     Type type = Type::Unknown;
-    void ReadVcProj();
-    void WriteVcProj();
-    void ParseConfigs();
-    void TransformConfigs(const StringVector& configurations, const std::string& rootDir);
-    void ConvertToMakefile(const std::string& ninjaBin, const StringVector& customDeps);
+    /// Paths of files read for conversion, to be prefetched.
+    StringVector GetInputFiles() const;
+    void         ReadVcProj(FilePrefetcher& files);
+    /// Writes converted project, marked with hash of its content, and its model next to it.
+    void WriteVcProj(const std::string& settingsKey);
+    /// If project was converted before and not changed since, loads its model instead of parsing.
+    /// Throws if converted project was modified or converted with other settings.
+    bool LoadConvertedModel(const std::string& settingsKey, FilePrefetcher& files);
+    void ParseConfigs(const StringVector& configurations, const StringVector& platforms);
+    /// embedDebugInfo replaces compile pdb with /Z7, so objects do not share a file and can be compiled anywhere.
+    /// fastLink makes exe and dll links incremental with /DEBUG:FASTLINK, without /OPT:REF and /OPT:ICF.
+    void TransformConfigs(const StringVector& configurations, const StringVector& platforms, const std::string& rootDir, bool embedDebugInfo, bool fastLink);
+    /// directTargets makes project build its output file instead of alias phony target.
+    void ConvertToMakefile(const std::string& ninjaBin, const StringVector& customDeps, bool directTargets);
     void CalculateDependentTargets(const std::vector<VcProjectInfo>& allTargets);
+    /// Finds which compiled sources include headers generated by custom commands of same config.
+    void ScanGeneratedIncludes(IncludeScanner& scanner);
+    /// Frees everything not needed once rules of project are generated. Kept are type and config names,
+    /// which rules of dependent projects refer to, and include dirs, which compile units refer to.
+    void ReleaseData();
+
+    static bool IsHeaderFile(const std::string& path);
+    /// Joins meaningful lines of CustomBuild script with " && "; cmd boilerplate (setlocal, error checks, labels) is dropped.
+    static std::string FilterCommandScript(std::string_view data);
 };
 using VcProjectList = std::vector<VcProjectInfo>;
 
+/// Groups projects so every project depends only on projects from previous groups; keeps solution order inside group.
+/// Requires CalculateDependentTargets to be done; throws on dependency cycle.
+std::vector<std::vector<VcProjectInfo*>> CalculateDependencyLevels(VcProjectList& projects);
+
 std::ostream& operator<<(std::ostream& os, const VcProjectInfo::Config& info);
 
 std::ostream& operator<<(std::ostream& os, const VcProjectInfo::ParsedConfig& info);
@@ -1,120 +1,128 @@
 #include <iostream>
-#include <string>
-#include <filesystem>
-#include <regex>
 #include <sstream>
-#include <fstream>
-#include <chrono>
-
-#include <filesystem>
-namespace fs = std::filesystem;
-using fserr  = std::error_code;
+#include <string>
+#include <future>
 
 #include "FileUtils.h"
-#include "VcProjectInfo.h"
+#include "Solution.h"
+#include "BuildGraph.h"
+#include "ModuleCollator.h"
 #include "CommandLine.h"
+#include "ThreadPool.h"
+#include "IncludeScanner.h"
 
-void parseSln(const std::string& slnBase, const std::string& slnName, VcProjectList& vcprojs, const bool dryRun)
-{
-    std::string filestr;
-    if (!FileInfo(slnBase + "/" + slnName).ReadFile(filestr))
-        throw std::runtime_error("Failed to read .sln file");
+// reads mostly wait for network volumes, so many of them are kept in flight.
+const size_t g_ioThreads = 32;
 
-    std::smatch res;
+/// Prints graph report and writes build.dot, as requested by cmd. Sources are weighted by includes only if they are scanned anyway.
+void ReportGraph(const CommandLine& cmd, const Solution& solution, ThreadPool& pool, IncludeScanner& scanner)
+{
+    const BuildGraph graph(solution.GetProjects(), &pool, cmd.scanIncludes ? &scanner : nullptr);
+    if (cmd.graphStats) {
+        // printed at once, solutions of batch are converted concurrently.
+        std::ostringstream report;
+        report << "Project graph of " << cmd.rootDir << ":\n";
+        graph.WriteStats(report);
+        std::cout << report.str() << std::flush;
+    }
+    if (cmd.writeDot) {
+        std::ostringstream dot;
+        graph.WriteDot(dot);
+        if (!FileInfo(cmd.rootDir + "/build.dot").WriteFile(dot.str()))
+            throw std::runtime_error("Failed to write file:" + cmd.rootDir + "/build.dot");
+    }
+}
 
-    std::regex                  exp(R"rx(Project\("\{[0-9A-F-]+\}"\) = "(\w+)", "(\w+\.vcxproj)", "\{([0-9A-F-]+)\}"\s*ProjectSection\(ProjectDependencies\) = postProject)rx", std::regex_constants::ECMAScript | std::regex_constants::optimize);
-    std::regex                  exp2(R"rx(\{([0-9A-F-]+)\} = )rx", std::regex_constants::ECMAScript | std::regex_constants::optimize);
-    std::string::const_iterator searchStart(filestr.cbegin());
-    std::string                 ALL_BUILD_GUID;
-    while (std::regex_search(searchStart, filestr.cend(), res, exp)) {
-        VcProjectInfo info;
-        info.baseDir    = slnBase;
-        info.targetName = res[1].str();
-        info.fileName   = res[2].str();
-        info.GUID       = res[3].str();
+/// Converts solution of cmd.rootDir. Returns false if it is up-to-date.
+bool ConvertSolution(const CommandLine& cmd, ThreadPool& pool, ThreadPool& ioPool, IncludeScanner& scanner)
+{
+    // graph is built from model, so it is loaded even if nothing changed.
+    const bool needGraph = cmd.graphStats || cmd.writeDot;
+    auto       solution  = std::make_unique<Solution>(cmd, pool, ioPool, scanner);
+    if (!cmd.dryRun && !needGraph && solution->IsUpToDate())
+        return false;
 
-        if (info.targetName == "ALL_BUILD")
-            ALL_BUILD_GUID = info.GUID;
+    solution->Load();
+    solution->WriteFiles();
+    if (needGraph)
+        ReportGraph(cmd, *solution, pool, scanner);
+    // single model lives until process exit, so big one is never destroyed; streaming one is small and owns temporary file.
+    // Models of batch are destroyed, or process would keep all of them.
+    if (!cmd.streaming && cmd.batchFile.empty())
+        solution.release();
+    return true;
+}
 
-        size_t      posStart = searchStart - filestr.cbegin() + res.position() + res.length();
-        size_t      posEnd   = filestr.find("EndProjectSection", posStart);
-        std::smatch res2;
+/// Converts all build directories listed in cmd.batchFile concurrently, sharing pools and caches. Returns exit code.
+int ConvertBatch(const CommandLine& cmd, ThreadPool& pool, ThreadPool& ioPool, IncludeScanner& scanner)
+{
+    std::string listData;
+    if (!FileInfo(cmd.batchFile).ReadFile(listData))
+        throw std::runtime_error("Failed to read batch file:" + cmd.batchFile);
 
-        std::string::const_iterator searchStart2(filestr.cbegin() + posStart);
-        while (std::regex_search(searchStart2, filestr.cbegin() + posEnd, res2, exp2)) {
-            info.dependentGuids.push_back(res2[1].str());
-            searchStart2 += res2.position() + res2.length();
+    // solutions only wait for project tasks and generate rules, so they run on own threads, not in pool.
+    const StringVector            buildDirs = strToList(listData, '\n');
+    std::vector<std::future<bool>> results;
+    for (const auto& dir : buildDirs) {
+        results.push_back(std::async(std::launch::async, [&cmd, &pool, &ioPool, &scanner, dir] {
+            CommandLine solutionCmd = cmd;
+            solutionCmd.SetBuildDir(dir);
+            return ConvertSolution(solutionCmd, pool, ioPool, scanner);
+        }));
+    }
+    int failed = 0;
+    for (size_t i = 0; i < buildDirs.size(); ++i) {
+        try {
+            const bool converted = results[i].get();
+            std::cout << buildDirs[i] << ": " << (converted ? "converted" : "up-to-date") << std::endl;
+        }
+        catch (std::exception& e) {
+            std::cout << buildDirs[i] << ": FAILED: " << e.what() << std::endl;
+            failed++;
         }
-        vcprojs.push_back(info);
-        searchStart += res.position() + res.length();
     }
-    std::regex post("postProject[\r\n\t {}=0-9A-F-]+EndProjectSection", std::regex_constants::ECMAScript | std::regex_constants::optimize);
-    filestr = std::regex_replace(filestr, post, "postProject\n\tEndProjectSection");
-#if 0 // todo:
-	std::regex buildGuid(R"rx(\{([0-9A-F-]+)\}\.\w+\|\w+.Build\.0 = \w+\|\w+)rx", std::regex_constants::ECMAScript | std::regex_constants::optimize);
-	searchStart = filestr.cbegin();
-	while ( std::regex_search( searchStart, filestr.cend(), res, buildGuid ) )
-	{
-		const std::string GUID       = res[1].str();
-		if (!ALL_BUILD_GUID.empty() && GUID != ALL_BUILD_GUID)
-		{
-			filestr.erase(searchStart + res.position(), searchStart + res.position() + res.length() );
-			continue;
-		}
+    std::cout << "Converted " << buildDirs.size() - failed << " of " << buildDirs.size() << " solutions" << std::endl;
+    return failed ? 1 : 0;
+}
+
+/// Checks solution of cmd.rootDir, or all of cmd.batchFile, without converting. Returns exit code: 1 if conversion is needed.
+int CheckSolutions(const CommandLine& cmd)
+{
+    if (cmd.batchFile.empty())
+        return Solution::IsUpToDate(cmd) ? 0 : 1;
 
-		searchStart += res.position() + res.length();
-	}
-#endif
-    if (!dryRun && !FileInfo(slnBase + "/" + slnName).WriteFile(filestr))
-        throw std::runtime_error("Failed to write file:" + slnName);
+    std::string listData;
+    if (!FileInfo(cmd.batchFile).ReadFile(listData))
+        throw std::runtime_error("Failed to read batch file:" + cmd.batchFile);
+    for (const auto& dir : strToList(listData, '\n')) {
+        CommandLine solutionCmd = cmd;
+        solutionCmd.SetBuildDir(dir);
+        if (!Solution::IsUpToDate(solutionCmd))
+            return 1;
+    }
+    return 0;
 }
 
 int main(int argc, char* argv[])
 {
     try {
         CommandLine cmd(argc, argv);
-        auto        checkFile = fs::path(cmd.rootDir) / (cmd.slnFile + ".timestamp");
-        if (!cmd.dryRun) {
-            std::error_code ec;
-            const auto      slnTime    = fs::last_write_time(fs::path(cmd.rootDir) / cmd.slnFile, ec);
-            const auto      checkTime  = fs::last_write_time(checkFile, ec);
-            const bool      needUpdate = slnTime > checkTime;
-            if (!needUpdate) {
-                std::cout << "Solution is up-to-date, skipping" << std::endl;
-                return 0;
-            }
-        }
-
-        //auto start = std::chrono::system_clock::now();
-        VcProjectList vcprojs;
-        parseSln(cmd.rootDir, cmd.slnFile, vcprojs, cmd.dryRun);
-
-        for (auto& p : vcprojs) {
-            p.ReadVcProj();
-            p.ParseConfigs();
-            p.TransformConfigs(cmd.configs, cmd.rootDir);
-            p.ConvertToMakefile(cmd.ninjaExe, cmd.additionalDeps[p.targetName]);
-            if (!cmd.dryRun)
-                p.WriteVcProj();
-        }
-
-        NinjaWriter ninjaWriter(cmd.rootDir, cmd.cmakeExe);
-        for (auto& p : vcprojs) {
-            p.CalculateDependentTargets(vcprojs);
-            ninjaWriter.GenerateNinjaRules(p);
+        if (!cmd.collationFile.empty()) {
+            ModuleCollation collation;
+            collation.Load(cmd.collationFile);
+            collation.Run();
+            return 0;
         }
-        //		std::cout << "Parsed projects:\n";
-        //		for (const auto & p : vcprojs)
-        //			std::cout << p;
+        if (cmd.check)
+            return CheckSolutions(cmd);
+        ThreadPool     pool(cmd.jobs);
+        ThreadPool     ioPool(g_ioThreads);
+        IncludeScanner scanner;
+        if (!cmd.batchFile.empty())
+            return ConvertBatch(cmd, pool, ioPool, scanner);
 
-        ninjaWriter.WriteFile(cmd.verbose);
-        if (!cmd.dryRun) {
-            FileInfo(checkFile.u8string()).WriteFile("1");
-        }
-        for (const auto& config : cmd.configs) {
-            FileInfo(cmd.rootDir + "/" + config + "/").Mkdirs();
-        }
-        //std::cout <<  "Elapsed time: " << std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::system_clock::now() - start ).count() << '\n';
+        if (!ConvertSolution(cmd, pool, ioPool, scanner))
+            std::cout << "Solution is up-to-date, skipping" << std::endl;
     }
     catch (std::exception& e) {
         std::cout << e.what() << std::endl;
@@ -0,0 +1,58 @@
+#[[
+  Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+  Source code licensed under the Apache License, Version 2.0 (the "License");
+  You may not use this file except in compliance with the License.
+  You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.h
+#]]
+
+# converts fixture solution with projects in sln order and shuffled, with one and many jobs, for each option set
+# changing how rules are generated; build.ninja must not depend on order or job count.
+# usage: cmake -DCONVERTER=<exe> -DFIXTURES=<dir> -DWORK_DIR=<dir> -P Determinism.cmake
+
+file(REMOVE_RECURSE ${WORK_DIR})
+file(MAKE_DIRECTORY ${WORK_DIR})
+
+# name:option, option is empty for plain conversion.
+foreach (optionSet plain: precise:--precise-codegen scan:--scan-includes)
+	string(REPLACE ":" ";" optionSet ${optionSet})
+	list(GET optionSet 0 setName)
+	list(LENGTH optionSet optionCount)
+	set(options)
+	if (optionCount GREATER 1)
+		list(GET optionSet 1 options)
+	endif()
+
+	set(reference)
+	foreach (run ordered:1 ordered:8 shuffled:1 shuffled:8)
+		string(REPLACE ":" ";" run ${run})
+		list(GET run 0 order)
+		list(GET run 1 jobs)
+		set(dir ${setName}_${order}_${jobs})
+		file(COPY ${FIXTURES}/solution/ DESTINATION ${WORK_DIR}/${dir})
+		if (order STREQUAL "shuffled")
+			configure_file(${FIXTURES}/shuffled.sln ${WORK_DIR}/${dir}/sol.sln COPYONLY)
+		endif()
+
+		# converter takes build directory relative to working one, as separators in it are changed to Windows ones.
+		execute_process(COMMAND ${CONVERTER} --build ${dir} --ninja ninja --cmake cmake --dry --jobs ${jobs} ${options}
+			WORKING_DIRECTORY ${WORK_DIR} RESULT_VARIABLE result OUTPUT_VARIABLE output ERROR_VARIABLE output)
+		if (NOT result EQUAL 0)
+			message(FATAL_ERROR "conversion of ${dir} failed: ${output}")
+		endif()
+
+		if (NOT reference)
+			set(reference ${dir})
+			continue()
+		endif()
+		execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${WORK_DIR}/${reference}/build.ninja ${WORK_DIR}/${dir}/build.ninja RESULT_VARIABLE result)
+		if (NOT result EQUAL 0)
+			message(FATAL_ERROR "build.ninja depends on project order or job count, compare ${WORK_DIR}/${reference} and ${WORK_DIR}/${dir}")
+		endif()
+	endforeach()
+endforeach()
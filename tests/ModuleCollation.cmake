@@ -0,0 +1,54 @@
+#[[
+  Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+  Source code licensed under the Apache License, Version 2.0 (the "License");
+  You may not use this file except in compliance with the License.
+  You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.h
+#]]
+
+# collates P1689 scan results of fixture targets, as ninja runs it, and compares dyndep, module map
+# and modules list outputs with expected ones; broken inputs must fail with clear message.
+# usage: cmake -DCONVERTER=<exe> -DFIXTURES=<dir> -DWORK_DIR=<dir> -P ModuleCollation.cmake
+
+set(source ${FIXTURES}/modules)
+file(REMOVE_RECURSE ${WORK_DIR})
+file(COPY ${source}/ DESTINATION ${WORK_DIR} PATTERN expected EXCLUDE)
+
+function(collate name expectedError)
+	execute_process(COMMAND ${CONVERTER} --collate-modules ${name}.collate
+		WORKING_DIRECTORY ${WORK_DIR} RESULT_VARIABLE result OUTPUT_VARIABLE output ERROR_VARIABLE output)
+	if (expectedError STREQUAL "")
+		if (NOT result EQUAL 0)
+			message(FATAL_ERROR "collation of ${name} failed: ${output}")
+		endif()
+	elseif (result EQUAL 0 OR NOT output MATCHES "${expectedError}")
+		message(FATAL_ERROR "collation of ${name} should fail with \"${expectedError}\", got ${result}: ${output}")
+	endif()
+endfunction()
+
+# library has interface, interface partition and internal partition, and imports std and header units;
+# application imports library module through its modules list.
+collate(lib "")
+collate(app "")
+collate(duplicate "Module core is provided by both dup/first.obj and dup/second.obj")
+collate(malformed "Broken scan result bad/broken.obj.ddi")
+
+file(GLOB_RECURSE expectedFiles RELATIVE ${source}/expected ${source}/expected/*)
+foreach (file ${expectedFiles})
+	execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${source}/expected/${file} ${WORK_DIR}/${file} RESULT_VARIABLE result)
+	if (NOT result EQUAL 0)
+		message(FATAL_ERROR "${file} differs from expected one, see ${WORK_DIR}")
+	endif()
+endforeach()
+
+# failed collations must not leave partial outputs for ninja to pick up.
+foreach (file dup/dup.dd dup/dup.modules bad/bad.dd bad/bad.modules)
+	if (EXISTS ${WORK_DIR}/${file})
+		message(FATAL_ERROR "${file} written by failed collation")
+	endif()
+endforeach()
@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2017 Smirnov Vladimir mapron1@gmail.com
+ * Source code licensed under the Apache License, Version 2.0 (the "License");
+ * You may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at http://www.apache.org/licenses/LICENSE-2.0 or in file COPYING-APACHE-2.0.txt
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.h
+ */
+
+// Microbenchmarks of conversion hot paths, each against plain implementation it replaced.
+// With --check every case runs once and only compares results, so it is cheap enough for CTest.
+
+#include "VcProjectInfo.h"
+#include "StringKernels.h"
+#include "ShardedMap.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace {
+const auto   g_minDuration = std::chrono::milliseconds(200);
+const size_t g_threads     = 4; // of cases running concurrently, like projects of one dependency level.
+
+bool            g_check = false;
+volatile size_t g_sink  = 0; // results are summed into it, so measured calls are not optimized out.
+
+/// Calls func repeatedly for g_minDuration and prints time per call; func returns anything summable into g_sink.
+template<class Func>
+void Measure(const std::string& name, Func&& func)
+{
+    using Clock       = std::chrono::steady_clock;
+    size_t     calls  = 0;
+    const auto start  = Clock::now();
+    auto       finish = start;
+    do {
+        g_sink = g_sink + size_t(func());
+        ++calls;
+        finish = Clock::now();
+    } while (!g_check && finish - start < g_minDuration);
+    if (!g_check)
+        std::cout << name << ": " << std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count() / calls << " ns\n";
+}
+
+void Expect(bool condition, const std::string& what)
+{
+    if (!condition)
+        throw std::runtime_error("Result mismatch: " + what);
+}
+
+/// Typical CMake-generated compile settings of one config.
+VcProjectInfo::ParsedConfig MakeConfig()
+{
+    VcProjectInfo::ParsedConfig pc;
+    for (int i = 0; i < 40; ++i)
+        pc.includes.push_back("C:\\src\\module" + std::to_string(i) + "\\include");
+    pc.includes.push_back("C:\\Program Files\\sdk\\inc");
+    for (int i = 0; i < 20; ++i)
+        pc.defines.push_back("FEATURE_" + std::to_string(i) + "=1");
+    pc.flags = { "/MD", "/EHsc", "/O2", "/Zi", "/W3", "-std:c++17", "/wd4251", "/wd4275" };
+    return pc;
+}
+
+/// Compile command fragments of every object: joined per object, as before, and taken from cache of config.
+void BenchFragments()
+{
+    const size_t objects = 100;
+    const auto   pc      = MakeConfig();
+    auto         joinPerObject = [&pc] {
+        size_t size = 0;
+        for (size_t i = 0; i < objects; ++i) {
+            std::string command;
+            appendJoined(command, pc.flags);
+            appendJoined(command, pc.defines, "/D");
+            appendJoined(command, pc.includes, "/I", ' ', true);
+            size += command.size();
+        }
+        return size;
+    };
+    auto useCached = [&pc] {
+        pc.fragments.reset();
+        size_t size = 0;
+        for (size_t i = 0; i < objects; ++i) {
+            const auto& fragments = pc.getFragments();
+            size += fragments.flags.size() + fragments.defines.size() + fragments.includes.size();
+        }
+        return size;
+    };
+    Expect(joinPerObject() == useCached(), "fragments");
+    Measure("fragments, joined per object (x100)", joinPerObject);
+    Measure("fragments, cached per config (x100)", useCached);
+}
+
+/// Custom command script translation: line regexes, as before, and single pass over lines.
+void BenchCommandScript()
+{
+    const std::string script = "setlocal\r\n"
+                               "cd C:\\build\\lib1\r\n"
+                               "if %errorlevel% neq 0 goto :cmEnd\r\n"
+                               "C:\\Python\\python.exe C:/src/gen.py --in C:/src/lib1/gen.in --out C:/build/gen_lib1.h\r\n"
+                               "if %errorlevel% neq 0 goto :cmEnd\r\n"
+                               ":cmEnd\r\n"
+                               "endlocal & call :cmErrorLevel %errorlevel% & goto :cmDone\r\n"
+                               ":cmErrorLevel\r\n"
+                               "exit /b %1\r\n"
+                               ":cmDone\r\n"
+                               "if %errorlevel% neq 0 goto :VCEnd";
+    auto         regexFilter = [&script] {
+        static const std::regex re("(if |exit |setlocal|endlocal|:).*[\r]?", std::regex_constants::ECMAScript | std::regex_constants::optimize);
+        static const std::regex reNL("[\r\n]", std::regex_constants::ECMAScript | std::regex_constants::optimize);
+        std::string             result;
+        for (const auto& line : strToList(script, '\n')) {
+            if (line.size() < 4 || std::regex_match(line, re))
+                continue;
+            if (!result.empty())
+                result += " && ";
+            result += std::regex_replace(line, reNL, "");
+        }
+        return result;
+    };
+    Expect(regexFilter() == VcProjectInfo::FilterCommandScript(script), "command script");
+    Measure("command script, regex", [&regexFilter] { return regexFilter().size(); });
+    Measure("command script, line scan", [&script] { return VcProjectInfo::FilterCommandScript(script).size(); });
+}
+
+/// Character kernels on typical MSBuild values, against plain character loops.
+void BenchStringKernels()
+{
+    const std::string path = "C:\\build\\src\\components\\network\\protocols\\http2\\session_manager (copy).cpp";
+    const std::string list = " C:\\src\\include ; C:\\src\\lib1;C:\\Program Files\\sdk\\inc ;; C:\\src\\third_party\\boost;%(AdditionalIncludeDirectories) ";
+
+    auto plainSplit = [&list] {
+        StringVector result;
+        for (size_t pos = 0; pos <= list.size();) {
+            const size_t end = std::min(list.find(';', pos), list.size());
+            size_t       b = pos, e = end;
+            while (b < e && std::isspace(static_cast<unsigned char>(list[b])))
+                ++b;
+            while (e > b && std::isspace(static_cast<unsigned char>(list[e - 1])))
+                --e;
+            if (e > b)
+                result.emplace_back(list, b, e - b);
+            pos = end + 1;
+        }
+        return result;
+    };
+    auto plainEscape = [&path] {
+        std::string result;
+        for (char c : path) {
+            if (c == ' ' || c == ':')
+                result += '$';
+            result += c;
+        }
+        return result;
+    };
+    auto plainReplace = [&path] {
+        std::string result = path;
+        std::replace(result.begin(), result.end(), '\\', '/');
+        return result;
+    };
+    auto kernelReplace = [&path] {
+        std::string result = path;
+        ReplaceAll(result, "\\", '/');
+        return result;
+    };
+    Expect(std::string_view(path).find_first_of("()") == FindFirstOf(path, "()"), "FindFirstOf");
+    Expect(plainSplit() == SplitTrimmed(list, ';'), "SplitTrimmed");
+    Expect(plainEscape() == EscapeAll(path, " :", '$'), "EscapeAll");
+    Expect(plainReplace() == kernelReplace(), "ReplaceAll");
+
+    Measure("find first of, string_view", [&path] { return std::string_view(path).find_first_of("()"); });
+    Measure("find first of, kernel", [&path] { return FindFirstOf(path, "()"); });
+    Measure("split list, plain", [&plainSplit] { return plainSplit().size(); });
+    Measure("split list, kernel", [&list] { return SplitTrimmed(list, ';').size(); });
+    Measure("escape, plain", [&plainEscape] { return plainEscape().size(); });
+    Measure("escape, kernel", [&path] { return EscapeAll(path, " :", '$').size(); });
+    Measure("replace, plain", [&plainReplace] { return plainReplace().size(); });
+    Measure("replace, kernel", [&kernelReplace] { return kernelReplace().size(); });
+}
+
+/// Idents claimed from several threads: one map under one lock, as before, and sharded map; FastHash picks shards.
+void BenchShardedMap()
+{
+    StringVector keys;
+    for (int i = 0; i < 2000; ++i)
+        keys.push_back("C:\\src\\lib" + std::to_string(i % 50) + "\\gen(" + std::to_string(i) + ").h");
+
+    // every thread claims all keys, as projects of one level share most generated files.
+    auto claimAll = [&keys](auto&& claim) {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < g_threads; ++t)
+            threads.emplace_back([&keys, &claim] {
+                for (const auto& key : keys)
+                    claim(key);
+            });
+        for (auto& thread : threads)
+            thread.join();
+    };
+    auto singleLock = [&claimAll] {
+        std::mutex                         mutex;
+        std::map<std::string, std::string> idents;
+        claimAll([&mutex, &idents](const std::string& key) {
+            std::lock_guard<std::mutex> lock(mutex);
+            idents.emplace(key, "ident" + std::to_string(idents.size()));
+        });
+        return idents;
+    };
+    auto sharded = [&claimAll] {
+        auto idents = std::make_unique<ShardedMap<std::map<std::string, std::string, StringViewLess>>>();
+        claimAll([&idents](const std::string& key) {
+            idents->Update(key, [&key](auto& shard) { return shard.emplace(key, "ident").second; });
+        });
+        return idents;
+    };
+    const auto singleIdents  = singleLock();
+    const auto shardedIdents = sharded();
+    const auto sorted        = shardedIdents->GetSorted();
+    Expect(sorted.size() == singleIdents.size() && std::equal(sorted.cbegin(), sorted.cend(), singleIdents.cbegin(), [](const auto* l, const auto& r) { return l->first == r.first; }), "ShardedMap");
+
+    Measure("claim idents, single lock", [&singleLock] { return singleLock().size(); });
+    Measure("claim idents, sharded", [&sharded] { return sharded()->GetSorted().size(); });
+    Measure("hash key, std::hash", [&keys] { return std::hash<std::string>()(keys[1234]); });
+    Measure("hash key, FastHash", [&keys] { return FastHash(keys[1234]); });
+}
+}
+
+int main(int argc, char* argv[])
+{
+    g_check = argc > 1 && std::string(argv[1]) == "--check";
+    try {
+        BenchFragments();
+        BenchCommandScript();
+        BenchStringKernels();
+        BenchShardedMap();
+    }
+    catch (std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}